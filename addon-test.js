@@ -12,5 +12,24 @@ ledlib.setColor(0, 255, 0, 0);
 ledlib.send();
 
 setTimeout(() => {
-  ledlib.cleanup();
+  // R,G,B bytes for all the LEDs at once
+  const pixels = new Uint8Array(12 * 3);
+  for (let i = 0; i < 12; i++) {
+    pixels[i * 3 + (i % 3)] = 255;
+  }
+  ledlib.sendFrame(pixels);
 }, 1000);
+
+setTimeout(() => {
+  // the same frame rotated, sent without blocking the event loop
+  const pixels = new Uint8Array(12 * 3);
+  for (let i = 0; i < 12; i++) {
+    pixels[i * 3 + ((i + 1) % 3)] = 255;
+  }
+  ledlib.sendAsync(pixels).then(() => console.log('sent'),
+                                (err) => console.log(err.message));
+}, 1500);
+
+setTimeout(() => {
+  ledlib.cleanup();
+}, 2000);
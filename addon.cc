@@ -8,24 +8,43 @@
  */
 
 #include <node.h>
+#include <node_buffer.h>
+#include <climits>
+#include <cmath>
+#include <uv.h>
 extern "C" {
   #include "serialled.h"
 }
 
 namespace serialled {
 
+using v8::ArrayBufferView;
 using v8::Exception;
 using v8::FunctionCallbackInfo;
+using v8::HandleScope;
 using v8::Isolate;
 using v8::Local;
 using v8::Number;
 using v8::Object;
+using v8::Persistent;
+using v8::Promise;
 using v8::String;
+using v8::Undefined;
 using v8::Value;
 
 const int SUCCESS = 0;
 const int FAILURE = -1;
 
+// sendAsync() calls ledSend() on a thread of the libuv thread pool;
+// this lock keeps the other functions off the strip meanwhile.
+static uv_mutex_t stripLock;
+
+class StripLock {
+ public:
+  StripLock()  { uv_mutex_lock(&stripLock); }
+  ~StripLock() { uv_mutex_unlock(&stripLock); }
+};
+
 inline int convertArgs(const FunctionCallbackInfo<Value>& args,
                        int argv[], const int n)
 {
@@ -50,17 +69,194 @@ inline int convertArgs(const FunctionCallbackInfo<Value>& args,
   return SUCCESS;
 }
 
+// Convert the optional argument i: `def` if it is absent or undefined
+inline int convertOptionalArg(const FunctionCallbackInfo<Value>& args,
+                              int i, int* value, const int def)
+{
+  Isolate* isolate = args.GetIsolate();
+
+  if (args.Length() <= i || args[i]->IsUndefined()) {
+    *value = def;
+    return SUCCESS;
+  }
+  // NaN and out-of-range numbers have no int value either
+  double d = (args[i]->IsNumber() ? args[i]->NumberValue() : NAN);
+  if (!(d >= INT_MIN && d <= INT_MAX)) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Wrong arguments")));
+    return FAILURE;
+  }
+  *value = d;
+  return SUCCESS;
+}
+
 void SetColor(const FunctionCallbackInfo<Value>& args) {
   int v[4];
   if (convertArgs(args, v, 4) == FAILURE) { return; }
 
+  StripLock lock;
   ledSetColor(v[0], v[1], v[2], v[3]);
 }
 
+// setColorRGBW(led, r, g, b, w): for RGBW chips (see setChip())
+void SetColorRGBW(const FunctionCallbackInfo<Value>& args) {
+  int v[5];
+  if (convertArgs(args, v, 5) == FAILURE) { return; }
+
+  StripLock lock;
+  ledSetColorRGBW(v[0], v[1], v[2], v[3], v[4]);
+}
+
+// Get the bytes of a Buffer / Uint8Array argument without copying
+inline int getBytes(const FunctionCallbackInfo<Value>& args, int i,
+                    const unsigned char** data, int* length)
+{
+  Isolate* isolate = args.GetIsolate();
+
+  if (args.Length() <= i || !node::Buffer::HasInstance(args[i])) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "Buffer or Uint8Array expected")));
+    return FAILURE;
+  }
+  // Small typed arrays may live in the V8 heap and move during GC;
+  // Buffer() moves the contents out of the heap so that the pointer
+  // stays valid (even on another thread).
+  Local<ArrayBufferView>::Cast(args[i])->Buffer();
+  *data = reinterpret_cast<const unsigned char*>(node::Buffer::Data(args[i]));
+  *length = node::Buffer::Length(args[i]);
+  return SUCCESS;
+}
+
+// setPixels(pixels[, start[, order]])
+// pixels: a Buffer or Uint8Array of R,G,B bytes (3 bytes per LED;
+// R,G,B,W for RGBW chips)
+void SetPixels(const FunctionCallbackInfo<Value>& args) {
+  const unsigned char* data;
+  int length;
+  if (getBytes(args, 0, &data, &length) == FAILURE) { return; }
+
+  int start, order;
+  if (convertOptionalArg(args, 1, &start, 0) == FAILURE ||
+      convertOptionalArg(args, 2, &order, LED_ORDER_RGB) == FAILURE) {
+    return;
+  }
+  StripLock lock;
+  int result = ledSetPixels(start, length / ledBytesPerLed(), data, order);
+
+  Local<Number> ret = Number::New(args.GetIsolate(), result);
+  args.GetReturnValue().Set(ret);
+}
+
+// sendFrame(pixels[, order])
+void SendFrame(const FunctionCallbackInfo<Value>& args) {
+  const unsigned char* data;
+  int length;
+  if (getBytes(args, 0, &data, &length) == FAILURE) { return; }
+
+  int order;
+  if (convertOptionalArg(args, 1, &order, LED_ORDER_RGB) == FAILURE) {
+    return;
+  }
+  StripLock lock;
+  ledSendFrame(data, length / ledBytesPerLed(), order);
+}
+
+// A request of sendAsync()
+struct SendWork {
+  uv_work_t request;
+  Persistent<Promise::Resolver> resolver;
+  Persistent<Object> pixels;	// keeps the array alive while sending
+  const unsigned char* data;	// 0 if no pixels are given
+  int count;
+  int order;
+  int result;			// of ledSend(): -1 if the frame does not fit
+};
+
+// Runs on a thread of the thread pool
+static void SendWorker(uv_work_t* req) {
+  SendWork* work = static_cast<SendWork*>(req->data);
+  StripLock lock;
+  if (work->data != 0) {
+    // ledSendFrame(), with the result of ledSend()
+    ledSetPixels(0, work->count, work->data, work->order);
+  }
+  work->result = ledSend();
+}
+
+// Runs on the main thread after SendWorker()
+static void SendDone(uv_work_t* req, int status) {
+  SendWork* work = static_cast<SendWork*>(req->data);
+  Isolate* isolate = Isolate::GetCurrent();
+  HandleScope scope(isolate);
+
+  Local<Promise::Resolver> resolver =
+      Local<Promise::Resolver>::New(isolate, work->resolver);
+  if (work->result == -1) {
+    resolver->Reject(isolate->GetCurrentContext(), Exception::Error(
+        String::NewFromUtf8(isolate,
+                            "the frame does not fit the DMA buffer")));
+  } else {
+    resolver->Resolve(isolate->GetCurrentContext(), Undefined(isolate));
+  }
+
+  work->resolver.Reset();
+  work->pixels.Reset();
+  delete work;
+}
+
+// sendAsync([pixels[, order]]): returns a Promise, rejected if the frame
+// does not fit the DMA buffer (send() returns -1).
+// Encoding and handing the frame to the DMA are done on the libuv
+// thread pool, so the event loop is not blocked even if the DMA
+// buffers are busy.  If `pixels` (a Buffer or any typed array of
+// R,G,B bytes) is given, it is read directly on that thread; do not
+// modify it until the Promise is resolved.
+void SendAsync(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  SendWork* work = new SendWork;
+  work->data = 0;
+  work->count = 0;
+  work->order = LED_ORDER_RGB;
+  work->result = 0;
+
+  if (args.Length() > 0 && !args[0]->IsUndefined()) {
+    int length;
+    if (getBytes(args, 0, &work->data, &length) == FAILURE ||
+        convertOptionalArg(args, 1, &work->order, LED_ORDER_RGB) == FAILURE) {
+      delete work;
+      return;
+    }
+    work->count = length / ledBytesPerLed();
+    work->pixels.Reset(isolate, args[0].As<Object>());
+  }
+
+  Local<Promise::Resolver> resolver =
+      Promise::Resolver::New(isolate->GetCurrentContext()).ToLocalChecked();
+  work->resolver.Reset(isolate, resolver);
+  work->request.data = work;
+  uv_queue_work(uv_default_loop(), &work->request, SendWorker, SendDone);
+
+  args.GetReturnValue().Set(resolver->GetPromise());
+}
+
+// setChip(chip): call before setup()
+// chip: 0 (WS2812B), 1 (SK6812 RGBW), 2 (WS2811), or 3 (APA106)
+void SetChip(const FunctionCallbackInfo<Value>& args) {
+  int v[1];
+  if (convertArgs(args, v, 1) == FAILURE) { return; }
+
+  StripLock lock;
+  int result = ledSetChip(v[0]);
+
+  Local<Number> ret = Number::New(args.GetIsolate(), result);
+  args.GetReturnValue().Set(ret);
+}
+
 void Setup(const FunctionCallbackInfo<Value>& args) {
   int v[2];
   if (convertArgs(args, v, 2) == FAILURE) { return; }
 
+  StripLock lock;
   int result = ledSetup(v[0], v[1]);
 
   Local<Number> ret = Number::New(args.GetIsolate(), result);
@@ -68,18 +264,31 @@ void Setup(const FunctionCallbackInfo<Value>& args) {
 }
 
 void Cleanup(const FunctionCallbackInfo<Value>& args) {
+  StripLock lock;
   ledCleanup();
 }
 
+// send(): returns 0, or -1 if the frame does not fit the DMA buffer
 void Send(const FunctionCallbackInfo<Value>& args) {
-  ledSend();
+  StripLock lock;
+  int result = ledSend();
+
+  Local<Number> ret = Number::New(args.GetIsolate(), result);
+  args.GetReturnValue().Set(ret);
 }
 
 void Init(Local<Object> exports) {
+  uv_mutex_init(&stripLock);
+
   NODE_SET_METHOD(exports, "setColor", SetColor);
+  NODE_SET_METHOD(exports, "setColorRGBW", SetColorRGBW);
+  NODE_SET_METHOD(exports, "setPixels", SetPixels);
+  NODE_SET_METHOD(exports, "sendFrame", SendFrame);
+  NODE_SET_METHOD(exports, "setChip",  SetChip);
   NODE_SET_METHOD(exports, "setup",    Setup);
   NODE_SET_METHOD(exports, "cleanup",  Cleanup);
   NODE_SET_METHOD(exports, "send",     Send);
+  NODE_SET_METHOD(exports, "sendAsync", SendAsync);
 }
 
 NODE_MODULE(addon, Init)
@@ -0,0 +1,365 @@
+/*
+ * 色の設定からLEDに届くまでの速さを測るよ
+ * Benchmarks of the paths from setting colors to the LED strip,
+ * for strips of 10 to 10000 LEDs:
+ *   set_color_ns    ledStripSetColor() per LED
+ *   set_hsb_ns      ledStripSetColorHSB() per LED
+ *   set_hsb_batch_ns ledStripSetColorsHSB() per LED
+ *   encode_ns       the encoder into ordinary memory per LED
+ *   send_us         ledStripSend(): encoding into the DMA memory
+ *                   and starting the DMA, per frame (all LEDs changed)
+ *   write_block_us  pwmWriteBlock(): copying a frame into the DMA memory
+ *                   (mark:space mode only), per frame
+ *   latency_us      from ledStripSend() until ledStripWaitSent() returns
+ * The results are printed in CSV; a field is empty if the DMA memory
+ * for the frame cannot be allocated.
+ *
+ * With -t, the scaling of ledStripSend() over the threads encoding a
+ * frame (ledStripSetThreads()) is printed instead, for strips of 1000
+ * LEDs or more and for LED_PAR_MAX parallel strips of the same total:
+ *   threads         1..max
+ *   send_us         ledStripSend() per frame (all LEDs changed)
+ *   speedup         send_us of 1 thread / send_us
+ *   encode_fps      the frames per second the encoding allows
+ *   frame_fps       the frames per second the strip allows
+ *
+ * $ make bench
+ * $ ./bench > result.csv            # on the simulated backend (pwmsim.c)
+ * $ sudo ./bench -b hw > result.csv  # on the hardware
+ *
+ * Options:
+ *   -b backend  sim (default) or hw
+ *   -m mode     ms or serial (default: both)
+ *   -n max      the maximum number of LEDs (default 10000)
+ *   -t max      the scaling over 1..max threads (e.g. 4)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>	/* getopt */
+#include <time.h>	/* clock_gettime */
+
+#include "serialled.h"
+#include "pwmfifo.h"
+#include "ledencode.h"
+
+/* GPIO番号 */
+#define LED_GPIO  18
+
+/* the same values as serialled.c (mark:space mode, PLLD) */
+#define T0H		8
+#define T1H		16
+#define RST_BITS	40
+#define PWM_CLOCK_DIV	25
+#define T_CYCLE		25
+
+/* the number of calls to be measured for each LED (or frame) */
+#define CPU_CALLS	200000
+#define MAX_FRAMES	20
+
+/* the frames measured for each number of threads (-t) */
+#define THREAD_FRAMES	10
+
+/* the shortest strip measured with -t */
+#define THREAD_MIN_LEDS	1000
+
+static const int lengths[] = { 10, 30, 100, 300, 1000, 3000, 10000 };
+
+static double nowUs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/** ns per LED of ledStripSetColor() (hsb == 0) or ledStripSetColorHSB() */
+static double benchSetColor(led_strip_t *strip, int n, int hsb)
+{
+  int reps = CPU_CALLS / n + 1;
+  double t0, t1;
+  int r, i;
+
+  t0 = nowUs();
+  for (r = 0; r < reps; r++) {
+    for (i = 0; i < n; i++) {
+      if (hsb) {
+        ledStripSetColorHSB(strip, i, (i + r) % 360, 255, 128);
+      } else {
+        ledStripSetColor(strip, i, i & 0xff, r & 0xff, 0x80);
+      }
+    }
+  }
+  t1 = nowUs();
+  return (t1 - t0) * 1e3 / reps / n;
+}
+
+/** ns per LED of ledStripSetColorsHSB() */
+static double benchSetColorsHSB(led_strip_t *strip, int n)
+{
+  int reps = CPU_CALLS / n + 1;
+  int *h = malloc(n * sizeof(int));
+  int *s = malloc(n * sizeof(int));
+  int *v = malloc(n * sizeof(int));
+  double t0, t1;
+  int r, i;
+
+  for (i = 0; i < n; i++) {
+    s[i] = 255;
+    v[i] = 128;
+  }
+  t0 = nowUs();
+  for (r = 0; r < reps; r++) {
+    for (i = 0; i < n; i++) {
+      h[i] = (i + r) % 360;
+    }
+    ledStripSetColorsHSB(strip, 0, n, h, s, v);
+  }
+  t1 = nowUs();
+  free(h);
+  free(s);
+  free(v);
+  return (t1 - t0) * 1e3 / reps / n;
+}
+
+/** ns per LED of the encoder */
+static double benchEncode(int n, int mode)
+{
+  static led_encoder_t encoder;
+  int reps = CPU_CALLS / n + 1;
+  unsigned int *colors = malloc(n * sizeof(unsigned int));
+  uint32_t *words = malloc((n * 24 + RST_BITS) * sizeof(uint32_t));
+  double t0, t1;
+  int r, i;
+
+  ledEncoderInit(&encoder, T0H, T1H);
+  for (i = 0; i < n; i++) {
+    colors[i] = rand() & 0xffffff;
+  }
+  t0 = nowUs();
+  for (r = 0; r < reps; r++) {
+    if (mode == LED_MODE_SERIAL) {
+      ledEncodeSerial(&encoder, words, colors, n, 3, RST_BITS, 1);
+    } else {
+      ledEncodeMS(&encoder, words, colors, n, 3, RST_BITS, 1);
+    }
+  }
+  t1 = nowUs();
+  free(colors);
+  free(words);
+  return (t1 - t0) * 1e3 / reps / n;
+}
+
+/**
+ * us per frame of ledStripSend() and until the frame has been sent.
+ * \return  -1 if the frame does not fit.
+ */
+static int benchSend(led_strip_t *strip, int n, double *send,
+                     double *latency)
+{
+  int frames = 1 + 1000 / n;
+  double t0, t1, t2;
+  int f, i;
+
+  if (frames > MAX_FRAMES) { frames = MAX_FRAMES; }
+  *send = *latency = 0;
+  for (f = 0; f < frames; f++) {
+    for (i = 0; i < n; i++) {
+      ledStripSetColor(strip, i, f, i & 0xff, 0x40);
+    }
+    ledStripWaitSent(strip, -1);
+    t0 = nowUs();
+    if (ledStripSend(strip) == -1) { return -1; }
+    t1 = nowUs();
+    ledStripWaitSent(strip, -1);
+    t2 = nowUs();
+    *send += t1 - t0;
+    *latency += t2 - t0;
+  }
+  *send /= frames;
+  *latency /= frames;
+  return 0;
+}
+
+/**
+ * us per frame of pwmWriteBlock() (mark:space mode).
+ * \return  -1 for failure.
+ */
+static double benchWriteBlock(int n)
+{
+  int len = n * 24 + RST_BITS;
+  int frames = 1 + 1000 / n;
+  unsigned char *bytes;
+  double t0, t = 0;
+  int f;
+
+  if (frames > MAX_FRAMES) { frames = MAX_FRAMES; }
+  if (setupGpioSize(len) == -1) { return -1; }
+  pinModePwmFifo(LED_GPIO);
+  pwmSetModeMS(LED_GPIO);
+  pwmSetClock(PWM_CLOCK_DIV);
+  pwmSetRange(LED_GPIO, T_CYCLE);
+
+  bytes = calloc(len, 1);
+  for (f = 0; f < frames; f++) {
+    pwmWaitSent(-1);
+    t0 = nowUs();
+    if (pwmWriteBlock(bytes, len) == -1) {
+      t = -1;
+      break;
+    }
+    t += nowUs() - t0;
+  }
+  pwmWaitSent(-1);
+  free(bytes);
+  cleanupGpio();
+  return (t < 0 ? -1 : t / frames);
+}
+
+/**
+ * us per frame of ledStripSend() encoding the whole frame
+ * (the frame before has been sent, so the time is all encoding).
+ * \return  -1 if the frame does not fit.
+ */
+static double benchSendFrames(led_strip_t *strip, int n, int frames)
+{
+  double t0, t = 0;
+  int f, i;
+
+  for (f = -1; f < frames; f++) {	/* frame -1 warms up */
+    for (i = 0; i < n; i++) {
+      ledStripSetColor(strip, i, f, i & 0xff, 0x40);
+    }
+    ledStripWaitSent(strip, -1);
+    t0 = nowUs();
+    if (ledStripSend(strip) == -1) { return -1; }
+    if (f >= 0) { t += nowUs() - t0; }
+  }
+  ledStripWaitSent(strip, -1);
+  return t / frames;
+}
+
+/**
+ * Print the scaling of ledStripSend() over 1..maxThreads threads
+ * for a strip of n LEDs (par: LED_PAR_MAX parallel strips).
+ */
+static void benchThreads(const char *backend, int mode, int par, int n,
+                         int maxThreads)
+{
+  static const int pins[LED_PAR_MAX] = {
+    4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 22, 23
+  };
+  led_strip_t *strip;
+  double send, single = 0;
+  int t;
+
+  strip = (par ? ledStripCreateParallel(pins, LED_PAR_MAX, n / LED_PAR_MAX,
+                                        LED_CHIP_WS2812B)
+               : ledStripCreate(LED_GPIO, n, mode));
+  if (strip == 0) {
+    fprintf(stderr, "cannot create a strip of %d LEDs\n", n);
+    return;
+  }
+  for (t = 1; t <= maxThreads; t++) {
+    ledStripSetThreads(strip, t);
+    send = benchSendFrames(strip, n, THREAD_FRAMES);
+    if (t == 1) { single = send; }
+    printf("%s,%s,%d,%d,", backend,
+           (par ? "par" : mode == LED_MODE_SERIAL ? "serial" : "ms"), n, t);
+    if (send > 0) {
+      printf("%.1f,%.2f,%.0f", send, single / send, 1e6 / send);
+    } else {
+      printf(",,");
+    }
+    printf(",%.0f\n", 1e6 / ledStripFrameUs(strip));
+    fflush(stdout);
+  }
+  ledStripDestroy(strip);
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-b sim|hw] [-m ms|serial] [-n max-LEDs]"
+          " [-t max-threads]\n", name);
+  exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *backend = "sim";
+  int modes[2] = { LED_MODE_MS, LED_MODE_SERIAL };
+  int nModes = 2, maxLed = 10000, maxThreads = 0;
+  int opt, m, k;
+
+  while ((opt = getopt(argc, argv, "b:m:n:t:")) != -1) {
+    switch (opt) {
+    case 'b': backend = optarg; break;
+    case 'm':
+      nModes = 1;
+      modes[0] = (strcmp(optarg, "serial") == 0 ? LED_MODE_SERIAL
+                                                : LED_MODE_MS);
+      break;
+    case 'n': maxLed = atoi(optarg); break;
+    case 't': maxThreads = atoi(optarg); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (pwmSetBackend(backend) == -1) {
+    return 1;
+  }
+
+  if (maxThreads > 0) {
+    printf("backend,mode,leds,threads,send_us,speedup,encode_fps,"
+           "frame_fps\n");
+    for (m = 0; m <= nModes; m++) {	/* m == nModes: parallel */
+      for (k = 0; k < (int)(sizeof(lengths) / sizeof(lengths[0])); k++) {
+        int n = lengths[k];
+        if (n > maxLed) { break; }
+        if (n >= THREAD_MIN_LEDS) {
+          benchThreads(backend, (m < nModes ? modes[m] : LED_MODE_MS),
+                       m == nModes, n, maxThreads);
+        }
+      }
+    }
+    return 0;
+  }
+
+  printf("backend,mode,leds,set_color_ns,set_hsb_ns,set_hsb_batch_ns,"
+         "encode_ns,"
+         "send_us,write_block_us,latency_us\n");
+  for (m = 0; m < nModes; m++) {
+    int mode = modes[m];
+    for (k = 0; k < (int)(sizeof(lengths) / sizeof(lengths[0])); k++) {
+      int n = lengths[k];
+      led_strip_t *strip;
+      double setColor, setHsb, setHsbBatch, encode, send, latency, block;
+      int sent;
+
+      if (n > maxLed) { break; }
+      strip = ledStripCreate(LED_GPIO, n, mode);
+      if (strip == 0) {
+        fprintf(stderr, "cannot create a strip of %d LEDs\n", n);
+        return 1;
+      }
+      setColor = benchSetColor(strip, n, 0);
+      setHsb   = benchSetColor(strip, n, 1);
+      setHsbBatch = benchSetColorsHSB(strip, n);
+      encode   = benchEncode(n, mode);
+      sent     = benchSend(strip, n, &send, &latency);
+      ledStripDestroy(strip);
+      block = (mode == LED_MODE_MS ? benchWriteBlock(n) : -1);
+
+      printf("%s,%s,%d,%.2f,%.2f,%.2f,%.2f,", backend,
+             (mode == LED_MODE_SERIAL ? "serial" : "ms"), n,
+             setColor, setHsb, setHsbBatch, encode);
+      if (sent == 0)  { printf("%.1f", send); }
+      printf(",");
+      if (block >= 0) { printf("%.1f", block); }
+      printf(",");
+      if (sent == 0)  { printf("%.1f", latency); }
+      printf("\n");
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
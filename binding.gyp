@@ -2,7 +2,9 @@
   "targets": [
     {
       "target_name": "serialled",
-      "sources": [ "addon.cc", "serialled.c", "pwmfifo.c", "mailbox.c" ]
+      "sources": [ "addon.cc", "serialled.c", "pwmfifo.c", "pwmsim.c",
+                   "mailbox.c", "ledencode.c", "ledsched.c", "ledfade.c",
+                   "ledring.c", "ledpool.c" ]
     }
   ]
 }
@@ -0,0 +1,99 @@
+/*
+ * エンコーダの速さを測るよ
+ * A microbenchmark of the encoders in ledencode.c.
+ * It runs on any host (no LED strip is needed).
+ *
+ * $ make encbench
+ * $ ./encbench [number-of-LEDs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>	/* clock_gettime */
+
+#include "ledencode.h"
+
+#define T0H	8
+#define T1H	16
+#define RST_BITS	40
+#define N_REPEAT	2000
+
+static unsigned int *colors;
+static unsigned char *bytes;
+static uint32_t *words;
+static led_encoder_t encoder;
+
+/* The bit-by-bit loop of ledSend() and the copy in pwmWriteBlock() */
+static void encodeOld(int n)
+{
+  int i, j;
+  for (i = 0; i < n; i++) {
+    int col = colors[i];
+    int mask = (1 << 23);
+    for (j = 0; j < 24; j++) {
+      bytes[i * 24 + j] = ((col & mask) ? T1H : T0H);
+      mask >>= 1;
+    }
+  }
+  for (i = 0; i < RST_BITS; i++) {
+    bytes[n * 24 + i] = 0;
+  }
+  for (i = 0; i < n * 24 + RST_BITS; i++) {
+    words[i] = bytes[i];
+  }
+}
+
+static void encodeMS(int n)
+{
+  ledEncodeMS(&encoder, words, colors, n, 3, RST_BITS, 1);
+}
+
+static void encodeSerial(int n)
+{
+  ledEncodeSerial(&encoder, words, colors, n, 3, RST_BITS, 1);
+}
+
+/* Run `f` N_REPEAT times and print ns per LED */
+static void measure(const char *name, void (*f)(int), int n)
+{
+  struct timespec t0, t1;
+  double ns;
+  int r;
+
+  f(n);	/* warm up */
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (r = 0; r < N_REPEAT; r++) {
+    f(n);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+  printf("%-8s %8.2f ns/LED\n", name, ns / N_REPEAT / n);
+}
+
+int main(int argc, char *argv[])
+{
+  int n = (argc > 1 ? atoi(argv[1]) : 300);
+  int i;
+
+  if (n <= 0) {
+    fprintf(stderr, "usage: %s [number-of-LEDs]\n", argv[0]);
+    return 1;
+  }
+  colors = malloc(n * sizeof(unsigned int));
+  bytes  = malloc(n * 24 + RST_BITS);
+  words  = malloc((n * 24 + RST_BITS) * sizeof(uint32_t));
+  if (colors == 0 || bytes == 0 || words == 0) {
+    perror("malloc");
+    return 1;
+  }
+  for (i = 0; i < n; i++) {
+    colors[i] = rand() & 0xffffff;
+  }
+  ledEncoderInit(&encoder, T0H, T1H);
+
+  printf("%d LEDs\n", n);
+  measure("old",    encodeOld,    n);
+  measure("table",  encodeMS,     n);
+  measure("serial", encodeSerial, n);
+  return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * エンコーダの出力の波形を確かめるよ
+ * A check of the encoders in ledencode.c against the timings of the
+ * chips: known colors are encoded in the mark:space mode and in the
+ * serializer mode, the waveform is decoded from the words (the time of
+ * each high level and of each bit, from rising edge to rising edge),
+ * and it must give the same bits with T0H, T1H and the period of the
+ * chip within the tolerance, followed by the RESET code of the chip.
+ * It runs on any host (no LED strip is needed).
+ *
+ * $ make enccheck
+ * $ ./enccheck
+ * The exit status is 1 if any bit is wrong.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ledencode.h"
+
+/* the same value as serialled.c */
+#define PWM_CLOCK_NS	50	/* mark:space mode: 20MHz */
+
+/* T0H and T1H may differ from the data sheets by this much */
+#define TOLERANCE_NS	150
+
+#define N_LED		16
+
+/* the longest RESET code of the chips in bits (SK6812: 80us / 1.25us) */
+#define MAX_RST_BITS	64
+
+/* The chips of serialled.c (keep them the same as chips[] there) */
+static const struct {
+  const char *name;
+  int cycleNs, t0hNs, t1hNs;
+  int resetNs;			/* the minimum RESET code */
+  int bytesPerLed;
+  int subbits;
+  uint32_t code0, code1;
+} chips[] = {
+  { "ws2812b", 1250, 400, 800, 50000, 3, 3, 0x4, 0x6 },
+  { "sk6812", 1250, 300, 600, 80000, 4, 4, 0x8, 0xc },
+  { "ws2811", 2500, 500, 1200, 50000, 3, 4, 0x8, 0xc },
+  { "apa106", 1710, 350, 1360, 50000, 3, 4, 0x8, 0xe },
+};
+#define N_CHIPS  ((int)(sizeof(chips) / sizeof(chips[0])))
+
+static unsigned int colors[N_LED] = {
+  0x000000, 0xffffff, 0xa5c30f, 0x123456, 0x800001, 0x7ffffe, 0x55aa55,
+  0x0f0f0f,
+};
+static uint32_t words[N_LED * 32 + MAX_RST_BITS];
+
+/** Level of the sample i (of `bits` bits per word, MSB first) */
+static int level(const uint32_t *w, int i, int bits)
+{
+  if (bits == 0) { return 0; }
+  return (w[i / bits] >> (bits - 1 - i % bits)) & 1;
+}
+
+/**
+ * Decode samples of `sampleNs` each into bits and check them against
+ * the colors.  In the mark:space mode a word is a period of `range`
+ * samples, high for the first `word` of them (bits == 0).
+ * \return  The number of errors.
+ */
+static int check(const char *name, int c, const uint32_t *w, int nWords,
+                 int bits, int range, double sampleNs)
+{
+  int nb = chips[c].bytesPerLed;
+  int nBits = N_LED * nb * 8;
+  int nSamples = (bits == 0 ? nWords * range : nWords * bits);
+  int errors = 0, bit = 0, i = 0, rise, high, tail;
+
+  while (i < nSamples && bit < nBits) {
+    /* a bit: high from `rise`, then low until the next rising edge */
+    rise = i;
+    while (i < nSamples && (bits == 0 ? (int)w[i / range] > i % range
+                                      : level(w, i, bits))) {
+      i++;
+    }
+    high = i - rise;
+    while (i < nSamples && !(bits == 0 ? (int)w[i / range] > i % range
+                                       : level(w, i, bits))) {
+      i++;
+    }
+    {
+      double highNs = high * sampleNs, cycleNs = (i - rise) * sampleNs;
+      int led = bit / (nb * 8), k = nb * 8 - 1 - bit % (nb * 8);
+      int want = (colors[led] >> k) & 1;
+      int t = (want ? chips[c].t1hNs : chips[c].t0hNs);
+      int last = (bit == nBits - 1);
+      if (high == 0 || highNs < t - TOLERANCE_NS ||
+          highNs > t + TOLERANCE_NS ||
+          (!last && (cycleNs < chips[c].cycleNs - TOLERANCE_NS ||
+                     cycleNs > chips[c].cycleNs + TOLERANCE_NS))) {
+        if (errors++ < 5) {
+          printf("%s %s: LED %d bit %d (%d): high %.0f ns, period %.0f ns\n",
+                 name, chips[c].name, led, k, want, highNs, cycleNs);
+        }
+      }
+      if (last) {
+        /* the RESET code: low until the end */
+        tail = i - rise - high;
+        if (tail * sampleNs < chips[c].resetNs) {
+          printf("%s %s: RESET of %.0f ns\n", name, chips[c].name,
+                 tail * sampleNs);
+          errors++;
+        }
+      }
+    }
+    bit++;
+  }
+  if (bit < nBits) {
+    printf("%s %s: %d bits of %d\n", name, chips[c].name, bit, nBits);
+    errors++;
+  }
+  printf("%-6s %-8s %s\n", name, chips[c].name, (errors ? "NG" : "ok"));
+  return errors;
+}
+
+int main(void)
+{
+  static led_encoder_t enc;
+  int c, i, n, rstBits, errors = 0;
+
+  for (i = 8; i < N_LED; i++) {
+    colors[i] = rand() & 0xffffff;
+  }
+  for (c = 0; c < N_CHIPS; c++) {
+    int range = (chips[c].cycleNs + PWM_CLOCK_NS / 2) / PWM_CLOCK_NS;
+    double subNs = (double)chips[c].cycleNs / chips[c].subbits;
+
+    /* the RESET code in bits, as serialled.c computes it */
+    rstBits = ((chips[c].resetNs + chips[c].cycleNs - 1) / chips[c].cycleNs);
+    if (rstBits > MAX_RST_BITS) {
+      printf("%s: RESET of %d bits\n", chips[c].name, rstBits);
+      errors++;
+      continue;
+    }
+
+    if (chips[c].bytesPerLed == 4) {
+      for (i = 0; i < N_LED; i++) {
+        colors[i] = (colors[i] << 8) | (colors[i] & 0xff);
+      }
+    }
+
+    /* mark:space: a word of T0H or T1H clocks per bit */
+    ledEncoderInit(&enc,
+                   (chips[c].t0hNs + PWM_CLOCK_NS / 2) / PWM_CLOCK_NS,
+                   (chips[c].t1hNs + PWM_CLOCK_NS / 2) / PWM_CLOCK_NS);
+    n = ledEncodeMS(&enc, words, colors, N_LED, chips[c].bytesPerLed,
+                    rstBits, 1);
+    errors += check("ms", c, words, n, 0, range, PWM_CLOCK_NS);
+
+    /* serializer: `subbits` bits of cycleNs / subbits per bit */
+    if (ledEncoderSetSerial(&enc, chips[c].subbits, chips[c].code0,
+                            chips[c].code1) == -1) {
+      printf("serial %s: bad codes\n", chips[c].name);
+      errors++;
+      continue;
+    }
+    n = ledEncodeSerial(&enc, words, colors, N_LED, chips[c].bytesPerLed,
+                        rstBits, 1);
+    errors += check("serial", c, words, n, 32, 0, subNs);
+
+    if (chips[c].bytesPerLed == 4) {
+      for (i = 0; i < N_LED; i++) {
+        colors[i] >>= 8;
+      }
+    }
+  }
+  return (errors == 0 ? 0 : 1);
+}
@@ -0,0 +1,127 @@
+/*
+ * HSBの変換が正しいか確かめるよ
+ * A check of the HSB conversion of serialled.c, on any host
+ * (the strips are on the simulated backend, pwmsim.c):
+ *  - hsbToRgb() in integers against the former calculation in doubles,
+ *    for all 360 x 256 x 256 inputs: each component may differ by 1;
+ *  - ledStripSetColorsHSB() against ledStripSetColorHSB() per LED,
+ *    on a strip and its second strip of GRB and RGB: the colors must be
+ *    identical.
+ * serialled.c is included to see hsbToRgb() and the colors of a strip.
+ *
+ * $ make hsbcheck
+ * $ ./hsbcheck
+ * The exit status is 1 if any difference is too large.
+ */
+
+#include <stdio.h>
+
+#include "serialled.c"
+
+#define N_HUE  360
+
+/** The former conversion of ledStripSetColorHSB() (before integers) */
+static unsigned int hsbToRgbDouble(int h, int s, int v)
+{
+  int hgroup = (h / 60) % 6;
+  double f  = (double)(h % 60) / 60;
+  double ss = (double)s / RGB_MAX;
+  int p = (int)(v * (1.0 - ss));
+  int q = (int)(v * (1.0 - f * ss));
+  int t = (int)(v * (1.0 - (1.0 - f) * ss));
+  int r = 0, g = 0, b = 0;
+
+  switch (hgroup) {
+  case 0: r = v; g = t; b = p; break;
+  case 1: r = q; g = v; b = p; break;
+  case 2: r = p; g = v; b = t; break;
+  case 3: r = p; g = q; b = v; break;
+  case 4: r = t; g = p; b = v; break;
+  case 5: r = v; g = p; b = q; break;
+  }
+  return PACK_COLOR(r, g, b);
+}
+
+/** The largest difference of the components of two colors */
+static int maxDiff(unsigned int c1, unsigned int c2)
+{
+  int d = 0, k;
+  for (k = 0; k < 3; k++) {
+    int x = (int)((c1 >> (8 * k)) & 0xff) - (int)((c2 >> (8 * k)) & 0xff);
+    if (x < 0) { x = -x; }
+    if (x > d) { d = x; }
+  }
+  return d;
+}
+
+/** hsbToRgb() against hsbToRgbDouble(); \return the inputs off by > 1 */
+static long checkConversion(void)
+{
+  long bad = 0, exact = 0;
+  int h, s, v, worst = 0;
+
+  for (h = 0; h < N_HUE; h++) {
+    for (s = 0; s <= RGB_MAX; s++) {
+      for (v = 0; v <= RGB_MAX; v++) {
+        unsigned int c1 = hsbToRgb(h, s, v), c2 = hsbToRgbDouble(h, s, v);
+        int d = maxDiff(c1, c2);
+        if (d == 0) { exact++; }
+        if (d > worst) { worst = d; }
+        if (d > 1 && bad++ < 10) {
+          printf("h=%d s=%d v=%d: %06x (double: %06x)\n", h, s, v, c1, c2);
+        }
+      }
+    }
+  }
+  printf("conversion: %ld of %d exact, max difference %d\n",
+         exact, N_HUE * (RGB_MAX + 1) * (RGB_MAX + 1), worst);
+  return bad;
+}
+
+/** The batch call against the per-LED call; \return the LEDs differing */
+static long checkBatch(void)
+{
+  int h[N_HUE], s[N_HUE], v[N_HUE];
+  unsigned int single[N_HUE];
+  led_strip_t *strip;
+  long bad = 0;
+  int sv, i;
+
+  /* two strips of N_HUE / 2 LEDs: GRB (default) and RGB */
+  strip = ledStripCreateDual(18, N_HUE / 2, 13, N_HUE / 2, LED_MODE_MS);
+  if (strip == 0) {
+    printf("cannot create the strip\n");
+    return 1;
+  }
+  ledStripSetColorOrder(strip, 1, LED_ORDER_RGB);
+  for (sv = 0; sv < (RGB_MAX + 1) * (RGB_MAX + 1); sv++) {
+    for (i = 0; i < N_HUE; i++) {
+      h[i] = i;
+      s[i] = sv >> 8;
+      v[i] = sv & 0xff;
+      ledStripSetColorHSB(strip, i, h[i], s[i], v[i]);
+      single[i] = strip->color[i];
+      strip->color[i] = ~0u;	/* not a color: must be overwritten */
+    }
+    ledStripSetColorsHSB(strip, 0, N_HUE, h, s, v);
+    for (i = 0; i < N_HUE; i++) {
+      if (strip->color[i] != single[i] && bad++ < 10) {
+        printf("h=%d s=%d v=%d: %06x (per LED: %06x)\n",
+               h[i], s[i], v[i], strip->color[i], single[i]);
+      }
+    }
+  }
+  printf("batch: %ld LEDs differ from the per-LED call\n", bad);
+  ledStripDestroy(strip);
+  return bad;
+}
+
+int main(void)
+{
+  long bad;
+
+  if (pwmSetBackend("sim") == -1) { return 1; }
+  bad = checkConversion();
+  bad += checkBatch();
+  return (bad == 0 ? 0 : 1);
+}
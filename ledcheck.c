@@ -0,0 +1,205 @@
+/*
+ * PWMの出力を復号してタイミングを確かめるよ
+ * Decode the words shifted out of the PWM into the colors of the LEDs,
+ * and check the timing against the limits of the chip (WS2812B by default).
+ *
+ * $ make ledcheck
+ * $ SERIALLED_BACKEND=sim SERIALLED_SIM_CAPTURE=out.bin ./rainbow
+ * $ ./ledcheck out.bin           # a capture file of pwmsim.c
+ * $ ./ledcheck -w -m serial buf.bin  # raw 32-bit words of the FIFO
+ * $ ./ledcheck -p 4,5,6 out.bin  # parallel strips on GPIO 4, 5 and 6
+ *
+ * Options:
+ *   -w         the input is raw 32-bit words (not a capture file)
+ *   -m mode    ms (mark:space; default) or serial (with -w)
+ *   -d div     the PWM clock divider (with -w; 25 for ms, 208 for serial)
+ *   -o         the clock source is the 19.2MHz oscillator (with -w)
+ *   -r range   the PWM range (with -w; 25 for ms, 32 for serial)
+ *   -n ch      1, or 2 for the words of two channels interleaved (with -w)
+ *   -c chip    ws2812b (default), sk6812 (RGBW), ws2811, or apa106
+ *   -b bytes   bytes per LED (default: 3, or 4 for sk6812)
+ *   -p pins    decode these GPIO pins (ledStripCreateParallel()) instead
+ *              of the PWM channels, from a capture file
+ *   -q         do not print the colors
+ * The exit status is 1 if a timing error is found.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>	/* getopt */
+
+#include "leddecode.h"
+#include "pwmsim.h"
+
+static int quiet;
+
+/* the decoders of GPIO pins (-p) have `ch` PIN_CH + pin */
+#define PIN_CH	100
+
+static void printChannel(int ch)
+{
+  if (ch >= PIN_CH) {
+    printf("gpio %d", ch - PIN_CH);
+  } else {
+    printf("ch %d", ch);
+  }
+}
+
+static void printFrame(int ch, unsigned long frame,
+                       const unsigned int *colors, int n, void *arg)
+{
+  const led_decoder_t *dec = arg;
+  int i;
+  printChannel(ch);
+  printf(" frame %lu: %d LEDs\n", frame, n);
+  if (quiet) { return; }
+  for (i = 0; i < n; i++) {
+    /* 2 digits per byte, e.g. 8 for RGBW */
+    printf("%s%0*x", (i % 8 == 0 ? "  " : " "), 2 * dec->bytesPerLed,
+           colors[i]);
+    if (i % 8 == 7 || i == n - 1) { printf("\n"); }
+  }
+}
+
+static void printError(const led_decode_error_t *err, void *arg)
+{
+  const led_decoder_t *dec = arg;
+  printChannel(err->ch);
+  printf(" frame %lu bit %d (LED %d): %s",
+         err->frame, err->bit, err->bit / (dec->bytesPerLed * 8),
+         ledDecodeErrorName(err->kind));
+  if (err->kind != LED_ERR_PARTIAL) {
+    printf(" (%u ns)", err->ns);
+  }
+  printf("\n");
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-c chip] [-b bytes] [-p pins] [-q]"
+          " [capture-file]\n"
+          "       %s -w [-m ms|serial] [-d div] [-o] [-r range] [-n ch]"
+          " [-c chip] [-b bytes] [-q] [words-file]\n", name, name);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  led_decoder_t dec[2];
+  led_decoder_t pinDec[32];
+  int pins[32], nPins = 0;
+  led_timing_t timing;
+  FILE *fp = stdin;
+  int words = 0, serial = 0, div = 0, osc = 0, range = 0, nCh = 1;
+  const char *chip = "ws2812b";
+  int bytesPerLed = 0;
+  unsigned long errors = 0;
+  int c, opt;
+  char *p;
+
+  while ((opt = getopt(argc, argv, "wm:d:or:n:c:b:p:q")) != -1) {
+    switch (opt) {
+    case 'w': words = 1; break;
+    case 'm': serial = (strcmp(optarg, "serial") == 0); break;
+    case 'd': div = atoi(optarg); break;
+    case 'o': osc = 1; break;
+    case 'r': range = atoi(optarg); break;
+    case 'n': nCh = atoi(optarg); break;
+    case 'c': chip = optarg; break;
+    case 'b': bytesPerLed = atoi(optarg); break;
+    case 'p':
+      for (p = strtok(optarg, ","); p != 0 && nPins < 32;
+           p = strtok(0, ",")) {
+        pins[nPins++] = atoi(p) & 31;
+      }
+      break;
+    case 'q': quiet = 1; break;
+    default:  usage(argv[0]);
+    }
+  }
+  c = ledTimingChip(&timing, chip);
+  if (bytesPerLed == 0) { bytesPerLed = c; }
+  if (c == -1 || nCh < 1 || nCh > 2 || bytesPerLed < 1 || bytesPerLed > 4 ||
+      (nPins > 0 && words)) {
+    usage(argv[0]);
+  }
+  if (optind < argc && (fp = fopen(argv[optind], "rb")) == 0) {
+    perror(argv[optind]);
+    return 2;
+  }
+
+  for (c = 0; c < 2; c++) {
+    if (ledDecoderInit(&dec[c], &timing, c, bytesPerLed,
+                       printFrame, printError, &dec[c]) == -1) {
+      perror("ledDecoderInit");
+      return 2;
+    }
+  }
+  for (c = 0; c < nPins; c++) {
+    if (ledDecoderInit(&pinDec[c], &timing, PIN_CH + pins[c], bytesPerLed,
+                       printFrame, printError, &pinDec[c]) == -1) {
+      perror("ledDecoderInit");
+      return 2;
+    }
+  }
+
+  if (words) {
+    /* raw words: the timing comes from the options */
+    uint32_t clkPs, w;
+    if (div == 0)   { div = (serial ? (osc ? 8 : 208) : (osc ? 2 : 25)); }
+    if (range == 0) { range = (serial ? 32 : (osc ? 12 : 25)); }
+    clkPs = div * (osc ? 1000000000000LL / 19200000
+                       : 1000000000000LL / 500000000);
+    for (c = 0; fread(&w, sizeof(w), 1, fp) == 1; c = (c + 1) % nCh) {
+      ledDecodeWord(&dec[c], w, serial, range, clkPs);
+    }
+  } else {
+    /* a capture file: idle time between the words is low */
+    pwm_sim_sample_t s;
+    uint64_t end[2] = { 0, 0 };	/* when the last word of a channel ends */
+    uint64_t since = 0;		/* when the GPIO changed last */
+    uint32_t level = 0;
+    while (fread(&s, sizeof(s), 1, fp) == 1) {
+      if (s.ch == PWM_SIM_GPIO) {
+        /* the pins kept `level` until now */
+        for (c = 0; c < nPins && since != 0 && s.t > since; c++) {
+          ledDecodeLevel(&pinDec[c], (level >> pins[c]) & 1,
+                         (s.t - since) * 1000);
+        }
+        level = s.word;
+        since = s.t;
+        continue;
+      }
+      if (nPins > 0) { continue; }
+      c = s.ch & 1;
+      if (end[c] != 0 && s.t > end[c]) {
+        ledDecodeLevel(&dec[c], 0, (s.t - end[c]) * 1000);
+      }
+      ledDecodeWord(&dec[c], s.word, s.serial, s.range, s.clkPs);
+      end[c] = s.t + (uint64_t)s.range * s.clkPs / 1000;
+    }
+  }
+
+  for (c = 0; c < 2; c++) {
+    ledDecodeFinish(&dec[c]);
+  }
+  for (c = 0; c < nPins; c++) {
+    /* the pins stay low after the last change */
+    ledDecodeLevel(&pinDec[c], 0, (uint64_t)timing.resetMin * 1000);
+    ledDecodeFinish(&pinDec[c]);
+    printf("gpio %d: %lu frames, %lu errors\n",
+           pins[c], pinDec[c].nFrames, pinDec[c].nErrors);
+    errors += pinDec[c].nErrors;
+    ledDecoderFree(&pinDec[c]);
+  }
+  for (c = 0; c < 2; c++) {
+    if (dec[c].nFrames > 0) {
+      printf("ch %d: %lu frames, %lu errors\n",
+             c, dec[c].nFrames, dec[c].nErrors);
+    }
+    errors += dec[c].nErrors;
+    ledDecoderFree(&dec[c]);
+  }
+  return (errors > 0 ? 1 : 0);
+}
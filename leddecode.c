@@ -0,0 +1,294 @@
+/*
+ * leddecode.c:
+ * A decoder of the waveform sent to LED strips, checking its timing.
+ *
+ * The waveform is given as levels with their durations
+ * (ledDecodeLevel()) or as words shifted out by the PWM
+ * (ledDecodeWord()); it is cut into bits at each rising edge:
+ *     ____                ________
+ * 0: /    \________   1: /        \____
+ *    <---->              <-------->
+ *     high                 high
+ *    <------------>
+ *     cycle
+ * and a low time longer than `cycleMax` ends a frame (the RESET code,
+ * which is reported if it is shorter than `resetMin`).
+ * Like ledencode.c, this file does not touch any hardware.
+ *
+ * Copyright (c) 2017 Yoshiaki Takata
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>	/* malloc */
+#include <string.h>	/* memset, strcmp */
+#include "leddecode.h"
+
+/* initial room for the colors of a frame */
+#define INITIAL_LEDS	256
+
+/**
+ * Set the limits of WS2812B (see serialled.c):
+ * T0H 0.4us+-150ns, T1H 0.8us+-150ns, a bit 1.25us+-600ns,
+ * RESET >= 50us.
+ */
+void ledTimingWS2812B(led_timing_t *timing)
+{
+  timing->t0hMin = 250;
+  timing->t0hMax = 550;
+  timing->t1hMin = 650;
+  timing->t1hMax = 950;
+  timing->cycleMin = 650;
+  timing->cycleMax = 1850;
+  timing->resetMin = 50000;
+}
+
+/* The limits of the chips of serialled.c (ns) */
+static const struct {
+  const char *name;
+  led_timing_t timing;
+  int bytesPerLed;
+} chipTimings[] = {
+  /* T0H 0.4us, T1H 0.8us, 1.25us, RESET >= 50us */
+  { "ws2812b", { 250, 550, 650, 950, 650, 1850, 50000 }, 3 },
+  /* T0H 0.3us, T1H 0.6us, 1.25us (+-150ns each), RESET >= 80us; RGBW */
+  { "sk6812",  { 150, 450, 450, 750, 650, 1850, 80000 }, 4 },
+  /* T0H 0.5us, T1H 1.2us, 2.5us (+-150ns each), RESET >= 50us */
+  { "ws2811",  { 350, 650, 1050, 1350, 2200, 2800, 50000 }, 3 },
+  /* T0H 0.35us, T1H 1.36us, 1.71us (+-150ns each), RESET >= 50us */
+  { "apa106",  { 200, 500, 1210, 1510, 1410, 2010, 50000 }, 3 },
+};
+
+/**
+ * Set the limits of a chip by its name
+ * ("ws2812b", "sk6812" (RGBW), "ws2811" (400kHz), or "apa106").
+ * \return  The bytes per LED of the chip; -1 for an unknown name.
+ */
+int ledTimingChip(led_timing_t *timing, const char *name)
+{
+  int i;
+  for (i = 0; i < (int)(sizeof(chipTimings) / sizeof(chipTimings[0])); i++) {
+    if (strcmp(name, chipTimings[i].name) == 0) {
+      *timing = chipTimings[i].timing;
+      return chipTimings[i].bytesPerLed;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Initialize a decoder for one channel.
+ * \param dec         The decoder.
+ * \param timing      Timing limits (see ledTimingWS2812B()).
+ * \param ch          A number passed to the callbacks.
+ * \param bytesPerLed The number of bytes of one color (e.g. 3).
+ * \param onFrame     Called for each frame (may be 0).
+ * \param onError     Called for each timing error (may be 0).
+ * \param arg         Passed to the callbacks.
+ * \return  0 for success, -1 for failure.
+ */
+int ledDecoderInit(led_decoder_t *dec, const led_timing_t *timing, int ch,
+                   int bytesPerLed, led_frame_cb_t onFrame,
+                   led_error_cb_t onError, void *arg)
+{
+  memset(dec, 0, sizeof(led_decoder_t));
+  dec->timing = *timing;
+  dec->ch = ch;
+  dec->bytesPerLed = bytesPerLed;
+  dec->onFrame = onFrame;
+  dec->onError = onError;
+  dec->arg = arg;
+  dec->maxLed = INITIAL_LEDS;
+  dec->colors = calloc(dec->maxLed, sizeof(unsigned int));
+  return (dec->colors == 0 ? -1 : 0);
+}
+
+/**
+ * Release the memory of a decoder.
+ */
+void ledDecoderFree(led_decoder_t *dec)
+{
+  free(dec->colors);
+  dec->colors = 0;
+}
+
+static void report(led_decoder_t *dec, int kind, uint64_t ps)
+{
+  led_decode_error_t err;
+  dec->nErrors++;
+  if (dec->onError == 0) { return; }
+  err.kind = kind;
+  err.ch = dec->ch;
+  err.frame = dec->nFrames;
+  err.bit = dec->nBits;
+  err.ns = (uint32_t)(ps / 1000);
+  dec->onError(&err, dec->arg);
+}
+
+static void endFrame(led_decoder_t *dec)
+{
+  int bitsPerLed = dec->bytesPerLed * 8;
+  if (dec->nBits == 0) { return; }
+  if (dec->nBits % bitsPerLed != 0) {
+    report(dec, LED_ERR_PARTIAL, 0);
+  }
+  if (dec->onFrame != 0) {
+    dec->onFrame(dec->ch, dec->nFrames, dec->colors,
+                 (dec->nBits + bitsPerLed - 1) / bitsPerLed, dec->arg);
+  }
+  dec->nFrames++;
+  dec->nBits = 0;
+}
+
+/** A bit: a high time followed by a low time */
+static void bit(led_decoder_t *dec, uint64_t highPs, uint64_t lowPs)
+{
+  const led_timing_t *t = &dec->timing;
+  int bitsPerLed = dec->bytesPerLed * 8;
+  int value, led;
+  uint64_t cycle = highPs + lowPs;
+
+  if (highPs >= t->t0hMin * 1000ULL && highPs <= t->t0hMax * 1000ULL) {
+    value = 0;
+  } else if (highPs >= t->t1hMin * 1000ULL && highPs <= t->t1hMax * 1000ULL) {
+    value = 1;
+  } else {
+    /* guess by the middle of T0H and T1H */
+    value = (highPs * 2 > (t->t0hMax + t->t1hMin) * 1000ULL);
+    report(dec, LED_ERR_HIGH, highPs);
+  }
+  if (lowPs > t->cycleMax * 1000ULL && lowPs < t->resetMin * 1000ULL) {
+    /* longer than a bit: a RESET code, but too short */
+    report(dec, LED_ERR_RESET, lowPs);
+  } else if (lowPs < t->resetMin * 1000ULL &&
+             (cycle < t->cycleMin * 1000ULL ||
+              cycle > t->cycleMax * 1000ULL)) {
+    report(dec, LED_ERR_CYCLE, cycle);
+  }
+
+  led = dec->nBits / bitsPerLed;
+  if (led >= dec->maxLed) {
+    unsigned int *p = realloc(dec->colors,
+                              2 * dec->maxLed * sizeof(unsigned int));
+    if (p == 0) { return; }
+    memset(p + dec->maxLed, 0, dec->maxLed * sizeof(unsigned int));
+    dec->colors = p;
+    dec->maxLed *= 2;
+  }
+  if (dec->nBits % bitsPerLed == 0) {
+    dec->colors[led] = 0;
+  }
+  dec->colors[led] = (dec->colors[led] << 1) | value;
+  dec->nBits++;
+
+  if (lowPs > t->cycleMax * 1000ULL) {
+    endFrame(dec);
+  }
+}
+
+/** The end of a run of `level` */
+static void endRun(led_decoder_t *dec, int level, uint64_t ps)
+{
+  if (level) {
+    dec->highPs = ps;
+    dec->pending = 1;
+  } else if (dec->pending) {
+    dec->pending = 0;
+    bit(dec, dec->highPs, ps);
+  }
+}
+
+/**
+ * Feed the decoder with a level kept for a while.
+ * \param dec    The decoder.
+ * \param level  0 (low) or 1 (high).
+ * \param ps     The duration in ps.
+ */
+void ledDecodeLevel(led_decoder_t *dec, int level, uint64_t ps)
+{
+  if (ps == 0) { return; }
+  level = (level != 0);
+  if (level != dec->level) {
+    endRun(dec, dec->level, dec->runPs);
+    dec->level = level;
+    dec->runPs = 0;
+  }
+  dec->runPs += ps;
+}
+
+/**
+ * Feed the decoder with a word shifted out by the PWM.
+ * \param dec     The decoder.
+ * \param word    The word taken from the FIFO.
+ * \param serial  1 for the serializer mode, 0 for the mark:space mode.
+ * \param range   The range of the PWM channel.
+ * \param clkPs   The period of the PWM clock in ps.
+ */
+void ledDecodeWord(led_decoder_t *dec, uint32_t word, int serial,
+                   int range, uint32_t clkPs)
+{
+  int i;
+  if (serial) {
+    /* the top `range` bits, MSB first */
+    for (i = 0; i < range && i < 32; i++) {
+      ledDecodeLevel(dec, (word >> (31 - i)) & 1, clkPs);
+    }
+  } else {
+    uint32_t high = (word < (uint32_t)range ? word : (uint32_t)range);
+    ledDecodeLevel(dec, 1, (uint64_t)high * clkPs);
+    ledDecodeLevel(dec, 0, (uint64_t)(range - high) * clkPs);
+  }
+}
+
+/**
+ * Finish decoding: the current level is taken as the end of the
+ * waveform, and a frame without its RESET code is also reported.
+ */
+void ledDecodeFinish(led_decoder_t *dec)
+{
+  uint64_t lowPs = (dec->level ? 0 : dec->runPs);
+
+  endRun(dec, dec->level, dec->runPs);
+  if (dec->pending) {
+    /* a high level at the end */
+    dec->pending = 0;
+    bit(dec, dec->highPs, 0);
+  }
+  if (dec->nBits > 0) {
+    /* the frame has not been ended by a low time longer than a bit */
+    report(dec, LED_ERR_RESET, lowPs);
+  }
+  dec->level = 0;
+  dec->runPs = 0;
+  endFrame(dec);
+}
+
+/**
+ * A description of an error kind.
+ */
+const char *ledDecodeErrorName(int kind)
+{
+  switch (kind) {
+  case LED_ERR_HIGH:    return "high time out of spec";
+  case LED_ERR_CYCLE:   return "bit period out of spec";
+  case LED_ERR_PARTIAL: return "frame ends in the middle of a LED";
+  case LED_ERR_RESET:   return "RESET code too short";
+  }
+  return "unknown error";
+}
@@ -0,0 +1,71 @@
+/*
+ * leddecode.h:
+ * A decoder of the waveform sent to LED strips, checking its timing.
+ */
+#ifndef LEDDECODE_H
+#define LEDDECODE_H
+
+#include <stdint.h>
+
+/* Timing limits in ns */
+typedef struct {
+  uint32_t t0hMin, t0hMax;	/* high time of bit 0 */
+  uint32_t t1hMin, t1hMax;	/* high time of bit 1 */
+  uint32_t cycleMin, cycleMax;	/* period of a bit */
+  uint32_t resetMin;		/* low time of the RESET code */
+} led_timing_t;
+
+/* Kinds of timing errors */
+#define LED_ERR_HIGH	1	/* the high time is neither T0H nor T1H */
+#define LED_ERR_CYCLE	2	/* the bit period is out of range */
+#define LED_ERR_PARTIAL	3	/* a frame ends in the middle of a LED */
+#define LED_ERR_RESET	4	/* the low time ending a frame is too short */
+
+/* A timing error (passed to the error callback) */
+typedef struct {
+  int kind;		/* LED_ERR_... */
+  int ch;		/* the channel given to ledDecoderInit() */
+  unsigned long frame;	/* frame number (from 0) */
+  int bit;		/* bit number in the frame */
+  uint32_t ns;		/* the measured time */
+} led_decode_error_t;
+
+/* Called for each decoded frame: n colors (the MSB received first) */
+typedef void (*led_frame_cb_t)(int ch, unsigned long frame,
+                               const unsigned int *colors, int n, void *arg);
+typedef void (*led_error_cb_t)(const led_decode_error_t *err, void *arg);
+
+/* The state of a decoder for one channel */
+typedef struct {
+  led_timing_t timing;
+  int ch;
+  int bytesPerLed;
+  led_frame_cb_t onFrame;
+  led_error_cb_t onError;
+  void *arg;
+
+  int level;			/* the current level */
+  uint64_t runPs;		/* how long it has been kept */
+  uint64_t highPs;		/* the high time of the pending bit */
+  int pending;			/* a high pulse waits for its low time */
+
+  unsigned int *colors;		/* the frame being decoded */
+  int maxLed;
+  int nBits;
+  unsigned long nFrames;
+  unsigned long nErrors;
+} led_decoder_t;
+
+void ledTimingWS2812B(led_timing_t *timing);
+int ledTimingChip(led_timing_t *timing, const char *name);
+int ledDecoderInit(led_decoder_t *dec, const led_timing_t *timing, int ch,
+                   int bytesPerLed, led_frame_cb_t onFrame,
+                   led_error_cb_t onError, void *arg);
+void ledDecoderFree(led_decoder_t *dec);
+void ledDecodeLevel(led_decoder_t *dec, int level, uint64_t ps);
+void ledDecodeWord(led_decoder_t *dec, uint32_t word, int serial,
+                   int range, uint32_t clkPs);
+void ledDecodeFinish(led_decoder_t *dec);
+const char *ledDecodeErrorName(int kind);
+
+#endif /* LEDDECODE_H */
@@ -0,0 +1,302 @@
+/*
+ * ledencode.c:
+ * Encoders converting LED colors into data for the PWM FIFO.
+ *
+ * The functions in this file do not touch any hardware,
+ * so they can be compiled and checked on any host.
+ *
+ * Copyright (c) 2017 Yoshiaki Takata
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>	/* memcpy */
+#include "ledencode.h"
+
+/*
+ * NEON (ARMv7 with -mfpu=neon, or AArch64):
+ * the words for the mark:space mode are computed in vector registers
+ * and stored 128 bits at a time, instead of being copied from the table.
+ * This also halves the number of stores into the uncached DMA memory.
+ */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define USE_NEON  1
+# include <arm_neon.h>
+#endif
+
+/*
+ * The encoders below are written as inline functions taking the number
+ * of bytes per LED (3 for RGB, 4 for RGBW) and of bits per bit, and
+ * are instantiated for each combination of the constants; so the loops
+ * over the bytes are unrolled, and nothing in them depends on the chip.
+ */
+#if defined(__GNUC__)
+# define ALWAYS_INLINE  static inline __attribute__((always_inline))
+#else
+# define ALWAYS_INLINE  static inline
+#endif
+
+/**
+ * Build the lookup tables
+ * (the serializer mode uses SERIAL_CODE0 and SERIAL_CODE1).
+ * \param enc  Tables to be initialized.
+ * \param t0h  The PWM data representing bit 0 (mark:space mode).
+ * \param t1h  The PWM data representing bit 1 (mark:space mode).
+ */
+void ledEncoderInit(led_encoder_t *enc, unsigned int t0h, unsigned int t1h)
+{
+  int b, j;
+  enc->t0h = t0h;
+  enc->t1h = t1h;
+  for (b = 0; b < 256; b++) {
+    for (j = 0; j < 8; j++) {
+      int bit = (b >> (7 - j)) & 1;
+      enc->ms[b][j] = (bit ? t1h : t0h);
+    }
+  }
+  ledEncoderSetSerial(enc, SERIAL_SUBBITS, SERIAL_CODE0, SERIAL_CODE1);
+}
+
+/**
+ * Build the lookup table of the serializer mode for other codes.
+ * \param enc      Tables initialized by ledEncoderInit().
+ * \param subbits  The number of bits representing a bit
+ *                 (1..SERIAL_MAX_SUBBITS).
+ * \param code0    The bits representing bit 0 (e.g. 0x8 for 1000).
+ * \param code1    The bits representing bit 1 (e.g. 0xc for 1100).
+ * \return  0 for success, -1 for failure.
+ */
+int ledEncoderSetSerial(led_encoder_t *enc, int subbits,
+                        uint32_t code0, uint32_t code1)
+{
+  int b, j;
+  if (subbits < 1 || subbits > SERIAL_MAX_SUBBITS) { return -1; }
+  enc->subbits = subbits;
+  for (b = 0; b < 256; b++) {
+    uint32_t ser = 0;
+    for (j = 0; j < 8; j++) {
+      int bit = (b >> (7 - j)) & 1;
+      ser = (ser << subbits) | (bit ? code1 : code0);
+    }
+    enc->serial[b] = ser;
+  }
+  return 0;
+}
+
+/* ledEncodeMS() for a constant bytesPerLed */
+ALWAYS_INLINE int encodeMS(const led_encoder_t *enc, uint32_t *dst,
+                           const unsigned int *colors, int n,
+                           int bytesPerLed, int rstBits, int stride)
+{
+  uint32_t *p = dst;
+  int i, j, k;
+
+  if (stride != 1) {
+    for (i = 0; i < n; i++) {
+      unsigned int col = colors[i];
+      for (k = bytesPerLed - 1; k >= 0; k--) {
+        const uint32_t *t = enc->ms[(col >> (8 * k)) & 0xff];
+        for (j = 0; j < 8; j++) {
+          p[j * stride] = t[j];
+        }
+        p += 8 * stride;
+      }
+    }
+    for (i = 0; i < rstBits; i++) {
+      *p = 0;
+      p += stride;
+    }
+    return n * bytesPerLed * 8 + rstBits;
+  }
+#if USE_NEON
+  static const uint32_t maskHi[4] = { 0x80, 0x40, 0x20, 0x10 };
+  static const uint32_t maskLo[4] = { 0x08, 0x04, 0x02, 0x01 };
+  const uint32x4_t mhi = vld1q_u32(maskHi);
+  const uint32x4_t mlo = vld1q_u32(maskLo);
+  const uint32x4_t t0 = vdupq_n_u32(enc->t0h);
+  const uint32x4_t t1 = vdupq_n_u32(enc->t1h);
+
+  for (i = 0; i < n; i++) {
+    unsigned int col = colors[i];
+    for (k = bytesPerLed - 1; k >= 0; k--) {
+      uint32x4_t b = vdupq_n_u32((col >> (8 * k)) & 0xff);
+      vst1q_u32(p,     vbslq_u32(vtstq_u32(b, mhi), t1, t0));
+      vst1q_u32(p + 4, vbslq_u32(vtstq_u32(b, mlo), t1, t0));
+      p += 8;
+    }
+  }
+#else
+  for (i = 0; i < n; i++) {
+    unsigned int col = colors[i];
+    for (k = bytesPerLed - 1; k >= 0; k--) {
+      memcpy(p, enc->ms[(col >> (8 * k)) & 0xff], 8 * sizeof(uint32_t));
+      p += 8;
+    }
+  }
+#endif
+  /* RESET code */
+  for (i = 0; i < rstBits; i++) {
+    *p++ = 0;
+  }
+  return p - dst;
+}
+
+/**
+ * Encode colors for the PWM in the mark:space mode
+ * (one word per bit), followed by the RESET code.
+ * \param enc         Lookup tables.
+ * \param dst         Destination; it must have room for
+ *                    (n * bytesPerLed * 8 + rstBits) * stride words.
+ * \param colors      Colors of the LEDs (the MSB is transmitted first).
+ * \param n           The number of LEDs.
+ * \param bytesPerLed The number of bytes of one color (e.g. 3).
+ * \param rstBits     The length of the RESET code in bits.
+ * \param stride      Distance between two words in `dst`
+ *                    (2 for interleaving two PWM channels).
+ * \return  The number of words written to `dst`.
+ */
+int ledEncodeMS(const led_encoder_t *enc, uint32_t *dst,
+                const unsigned int *colors, int n,
+                int bytesPerLed, int rstBits, int stride)
+{
+  switch (bytesPerLed) {
+  case 3:  return encodeMS(enc, dst, colors, n, 3, rstBits, stride);
+  case 4:  return encodeMS(enc, dst, colors, n, 4, rstBits, stride);
+  default: return encodeMS(enc, dst, colors, n, bytesPerLed, rstBits, stride);
+  }
+}
+
+/* ledEncodeSerial() for constant bytesPerLed and subbits */
+ALWAYS_INLINE int encodeSerial(const led_encoder_t *enc, uint32_t *dst,
+                               const unsigned int *colors, int n,
+                               int bytesPerLed, int subbits,
+                               int rstBits, int stride)
+{
+  uint64_t acc = 0;	/* bits not yet written to dst */
+  int nacc = 0;		/* the number of valid bits in acc */
+  int nw = 0;
+  int i, k;
+
+  for (i = 0; i < n; i++) {
+    unsigned int col = colors[i];
+    for (k = bytesPerLed - 1; k >= 0; k--) {
+      acc = (acc << (8 * subbits)) |
+            enc->serial[(col >> (8 * k)) & 0xff];
+      nacc += 8 * subbits;
+      if (nacc >= 32) {
+        nacc -= 32;
+        dst[stride * nw++] = (uint32_t)(acc >> nacc);
+      }
+    }
+  }
+  /* the last partial word (padded with 0) */
+  if (nacc > 0) {
+    dst[stride * nw++] = (uint32_t)(acc << (32 - nacc));
+  }
+  /* RESET code */
+  for (i = 0; i < (rstBits * subbits + 31) / 32; i++) {
+    dst[stride * nw++] = 0;
+  }
+  return nw;
+}
+
+/**
+ * Encode colors for the PWM in the serializer mode.
+ * The bits of the colors are packed into 32-bit words
+ * (enc->subbits bits per color bit), followed by the RESET code.
+ * \param enc         Lookup tables.
+ * \param dst         Destination; it must have room for
+ *                    (SERIAL_N_WORDS_ENC(enc, n * bytesPerLed * 8) +
+ *                     SERIAL_N_WORDS_ENC(enc, rstBits)) * stride words.
+ * \param colors      Colors of the LEDs (the MSB is transmitted first).
+ * \param n           The number of LEDs.
+ * \param bytesPerLed The number of bytes of one color (e.g. 3).
+ * \param rstBits     The length of the RESET code in bits.
+ * \param stride      Distance between two words in `dst`.
+ * \return  The number of words written to `dst`.
+ */
+int ledEncodeSerial(const led_encoder_t *enc, uint32_t *dst,
+                    const unsigned int *colors, int n,
+                    int bytesPerLed, int rstBits, int stride)
+{
+#define ENCODE_SERIAL(b, s) \
+  encodeSerial(enc, dst, colors, n, b, s, rstBits, stride)
+
+  switch (bytesPerLed * 8 + enc->subbits) {
+  case 3 * 8 + 3: return ENCODE_SERIAL(3, 3);
+  case 3 * 8 + 4: return ENCODE_SERIAL(3, 4);
+  case 4 * 8 + 3: return ENCODE_SERIAL(4, 3);
+  case 4 * 8 + 4: return ENCODE_SERIAL(4, 4);
+  default:        return ENCODE_SERIAL(bytesPerLed, enc->subbits);
+  }
+#undef ENCODE_SERIAL
+}
+
+/* ledEncodeParallel() for a constant bytesPerLed */
+ALWAYS_INLINE int encodeParallel(uint32_t *dst,
+                                 const unsigned int *const *colors,
+                                 const uint32_t *pins, int nStrips, int n,
+                                 int bytesPerLed)
+{
+  const int nBits = 8 * bytesPerLed;
+  uint32_t planes[32];	/* the words of a LED, stored at once */
+  int i, j, s;
+
+  for (i = 0; i < n; i++) {
+    for (j = 0; j < nBits; j++) {
+      planes[j] = 0;
+    }
+    for (s = 0; s < nStrips; s++) {
+      unsigned int col = colors[s][i];
+      uint32_t pin = pins[s];
+      for (j = 0; j < nBits; j++) {
+        /* (bit - 1) is all ones for bit 0 */
+        planes[j] |= pin & (((col >> (nBits - 1 - j)) & 1) - 1);
+      }
+    }
+    memcpy(dst, planes, nBits * sizeof(uint32_t));
+    dst += nBits;
+  }
+  return n * nBits;
+}
+
+/**
+ * Encode colors of parallel strips into bit planes for the GPIO:
+ * for each bit of the colors (the MSB first), a word of the pins of
+ * the strips sending 0 (see pwmDmaOpenGpio() of pwmfifo.c).
+ * \param dst         Destination; it must have room for
+ *                    n * bytesPerLed * 8 words.
+ * \param colors      Colors of n LEDs of each strip.
+ * \param pins        The mask of the pin of each strip (e.g. 1 << 17).
+ * \param nStrips     The number of strips.
+ * \param n           The number of LEDs (of each strip).
+ * \param bytesPerLed The number of bytes of one color (e.g. 3).
+ * \return  The number of words written to `dst`.
+ */
+int ledEncodeParallel(uint32_t *dst, const unsigned int *const *colors,
+                      const uint32_t *pins, int nStrips, int n,
+                      int bytesPerLed)
+{
+  switch (bytesPerLed) {
+  case 3:  return encodeParallel(dst, colors, pins, nStrips, n, 3);
+  case 4:  return encodeParallel(dst, colors, pins, nStrips, n, 4);
+  default: return encodeParallel(dst, colors, pins, nStrips, n,
+                                 bytesPerLed);
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ * ledencode.h:
+ * Encoders converting LED colors into data for the PWM FIFO.
+ */
+#ifndef LEDENCODE_H
+#define LEDENCODE_H
+
+#include <stdint.h>
+
+/*
+ * Serializer mode:
+ * each bit of a color is represented by SERIAL_SUBBITS bits
+ * shifted out by the PWM, MSB first.
+ *     ____                ________
+ * 0: /    \________   1: /        \____
+ *     1     0   0          1   1    0
+ * These are the defaults of ledEncoderInit(); other chips may need
+ * other codes (see ledEncoderSetSerial()).
+ */
+#define SERIAL_SUBBITS	3
+#define SERIAL_CODE0	0x4	/* 100 */
+#define SERIAL_CODE1	0x6	/* 110 */
+
+/* The maximum number of bits representing a bit (8 of them fit a word) */
+#define SERIAL_MAX_SUBBITS	4
+
+/* The number of 32-bit words needed for `bits` bits (serializer mode) */
+#define SERIAL_N_WORDS(bits)	(((bits) * SERIAL_SUBBITS + 31) / 32)
+#define SERIAL_N_WORDS_ENC(enc,bits)	(((bits) * (enc)->subbits + 31) / 32)
+
+/*
+ * Lookup tables from a byte of a color to the FIFO data:
+ * - ms[b]     8 words (mark:space mode; T1H or T0H for each bit)
+ * - serial[b] 8 * subbits bits in the LSBs (serializer mode)
+ * Initialize them with ledEncoderInit().
+ */
+typedef struct {
+  uint32_t ms[256][8];
+  uint32_t serial[256];
+  uint32_t t0h, t1h;
+  int subbits;		/* bits per bit in the serializer mode */
+} led_encoder_t;
+
+void ledEncoderInit(led_encoder_t *enc, unsigned int t0h, unsigned int t1h);
+int ledEncoderSetSerial(led_encoder_t *enc, int subbits,
+                        uint32_t code0, uint32_t code1);
+int ledEncodeMS(const led_encoder_t *enc, uint32_t *dst,
+                const unsigned int *colors, int n,
+                int bytesPerLed, int rstBits, int stride);
+int ledEncodeSerial(const led_encoder_t *enc, uint32_t *dst,
+                    const unsigned int *colors, int n,
+                    int bytesPerLed, int rstBits, int stride);
+
+/*
+ * Parallel output on the GPIO:
+ * a word per bit of the colors, having the pins of the strips
+ * sending 0 (a transposition of the colors of the strips).
+ */
+int ledEncodeParallel(uint32_t *dst, const unsigned int *const *colors,
+                      const uint32_t *pins, int nStrips, int n,
+                      int bytesPerLed);
+
+#endif /* LEDENCODE_H */
@@ -0,0 +1,372 @@
+/*
+ * ledfade.c:
+ * A keyframe engine fading a strip between frames on its own thread.
+ *
+ * The caller queues target frames (keyframes) with the duration and
+ * the easing of the transition to each of them, and a render thread
+ * blends the frames in fixed point and sends them at a fixed rate
+ * (by ledsched.c; up to the maximum frame rate of the strip).
+ * So a slow client (e.g. Python through ctypes) gets smooth animations
+ * by a call per keyframe instead of per frame.
+ * While the engine runs, the thread owns the colors of the strip:
+ * set them only through ledFadeTo().
+ *
+ * Copyright (c) 2017 Yoshiaki Takata
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>	/* calloc */
+#include <string.h>	/* memcpy */
+#include <stdint.h>
+#include <time.h>	/* clock_gettime */
+#include <pthread.h>
+
+#include "ledfade.h"
+#include "ledsched.h"
+
+#define NSEC_PER_SEC	1000000000LL
+
+/* the frame rate of ledFadeCreate(strip, 0) is at most this */
+#define MAX_FPS		1000
+
+/* the weight of a blend: 0 (from) .. WEIGHT_ONE (to) */
+#define WEIGHT_BITS	16
+#define WEIGHT_ONE	(1 << WEIGHT_BITS)
+
+struct led_fade {
+  led_strip_t *strip;
+  led_sched_t *sched;
+  int64_t period;		/* ns */
+  int nBytes;			/* bytes of a frame (R,G,B(,W) order) */
+
+  pthread_t thread;
+  int running;			/* the thread has been created */
+  pthread_mutex_t lock;
+  pthread_cond_t queued;	/* a keyframe is queued, or stopping */
+  pthread_cond_t started;	/* a keyframe is taken, or all are done */
+  int stop;
+
+  /* the keyframes waiting: queue + nBytes * ((head + i) % LED_FADE_QUEUE) */
+  uint8_t *queue;
+  int durationMs[LED_FADE_QUEUE];
+  int easing[LED_FADE_QUEUE];
+  int head, count;
+  uint8_t *last;		/* the last keyframe queued */
+
+  /* the current transition (from -> to) and the frame sent */
+  int active;
+  uint8_t *from, *to, *out;
+  int64_t start, duration;	/* ns */
+  int ease;
+};
+
+static int64_t nowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * The weight of `to` at the fraction t (0..WEIGHT_ONE) of a transition.
+ */
+static unsigned int easeWeight(int easing, unsigned int t)
+{
+  uint64_t x = t;
+  switch (easing) {
+  case LED_EASE_IN:
+    return (unsigned int)(x * x >> WEIGHT_BITS);
+  case LED_EASE_OUT:
+    return (unsigned int)(x * (2 * WEIGHT_ONE - x) >> WEIGHT_BITS);
+  case LED_EASE_IN_OUT:
+    /* 3x^2 - 2x^3 */
+    return (unsigned int)(x * x * (3 * WEIGHT_ONE - 2 * x) >>
+                          (2 * WEIGHT_BITS));
+  default:
+    return t;
+  }
+}
+
+/**
+ * out = from + (to - from) * w, byte by byte
+ * (without branches, so that the loop can be vectorized).
+ */
+static void blend(uint8_t *out, const uint8_t *from, const uint8_t *to,
+                  unsigned int w, int n)
+{
+  int i;
+  for (i = 0; i < n; i++) {
+    int d = to[i] - from[i];
+    out[i] = (uint8_t)(from[i] +
+                       ((d * (int)w + WEIGHT_ONE / 2) >> WEIGHT_BITS));
+  }
+}
+
+/**
+ * Start the transition to the first keyframe of the queue
+ * from the frame sent last (called with the lock held).
+ */
+static void startNext(led_fade_t *fade, int64_t t)
+{
+  int q = fade->head;
+  memcpy(fade->from, fade->out, fade->nBytes);
+  memcpy(fade->to, fade->queue + fade->nBytes * q, fade->nBytes);
+  fade->duration = fade->durationMs[q] * 1000000LL;
+  fade->ease = fade->easing[q];
+  fade->start = t;
+  fade->active = 1;
+  fade->head = (q + 1) % LED_FADE_QUEUE;
+  fade->count--;
+  pthread_cond_broadcast(&fade->started);
+}
+
+/**
+ * Compute the frame shown at time t into `out`
+ * (called with the lock held).
+ * \return  1 if it is the last frame of the transition.
+ */
+static int render(led_fade_t *fade, int64_t t)
+{
+  int64_t elapsed = t - fade->start;
+  unsigned int w;
+
+  if (elapsed >= fade->duration) {
+    memcpy(fade->out, fade->to, fade->nBytes);
+    return 1;
+  }
+  w = (elapsed <= 0 ? 0 : (unsigned int)(elapsed * WEIGHT_ONE /
+                                         fade->duration));
+  blend(fade->out, fade->from, fade->to, easeWeight(fade->ease, w),
+        fade->nBytes);
+  return 0;
+}
+
+/** The render thread */
+static void *renderLoop(void *arg)
+{
+  led_fade_t *fade = arg;
+  int n = ledStripLength(fade->strip);
+
+  pthread_mutex_lock(&fade->lock);
+  while (!fade->stop) {
+    /* the frame is shown at the next deadline */
+    int64_t t = nowNs() + fade->period;
+    int end;
+    if (!fade->active) {
+      if (fade->count == 0) {
+        /* nothing to do: sleep until a keyframe is queued */
+        pthread_cond_wait(&fade->queued, &fade->lock);
+        continue;
+      }
+      startNext(fade, t);
+    }
+    end = render(fade, t);
+    pthread_mutex_unlock(&fade->lock);
+
+    /* only this thread writes `out` */
+    ledStripSetPixels(fade->strip, 0, n, fade->out, LED_ORDER_RGB);
+    ledSchedWait(fade->sched);
+    ledStripSend(fade->strip);
+
+    pthread_mutex_lock(&fade->lock);
+    if (end) {
+      /* the keyframe has been sent */
+      fade->active = 0;
+      if (fade->count == 0) {
+        pthread_cond_broadcast(&fade->started);	/* all done */
+      }
+    }
+  }
+  pthread_mutex_unlock(&fade->lock);
+  return 0;
+}
+
+/**
+ * Create a keyframe engine and start its render thread.
+ * The strip starts from black.
+ * \param strip  The strip (0 for the strip of ledSetup()).
+ * \param fps    Frames per second (0 for the maximum frame rate
+ *               of the strip, up to MAX_FPS).
+ * \return  The engine; 0 for failure.
+ */
+led_fade_t *ledFadeCreate(led_strip_t *strip, double fps)
+{
+  led_fade_t *fade;
+  pthread_condattr_t attr;
+
+  if (strip == 0) { strip = ledGetStrip(); }
+  if (strip == 0 || fps < 0) { return 0; }
+  if (fps == 0) {
+    int us = ledStripFrameUs(strip);
+    fps = (us * MAX_FPS < 1000000 ? MAX_FPS : 1e6 / us);
+  }
+  fade = calloc(1, sizeof(led_fade_t));
+  if (fade == 0) { return 0; }
+  fade->strip = strip;
+  fade->period = (int64_t)(NSEC_PER_SEC / fps + 0.5);
+  fade->nBytes = ledStripLength(strip) * ledStripBytesPerLed(strip);
+  /* the keyframes waiting, `last`, `from`, `to`, and `out` */
+  fade->queue = calloc(LED_FADE_QUEUE + 4, fade->nBytes + 1);
+  fade->sched = ledSchedCreate(strip, fps, 0);
+  if (fade->queue == 0 || fade->sched == 0) {
+    ledSchedDestroy(fade->sched);
+    free(fade->queue);
+    free(fade);
+    return 0;
+  }
+  fade->last = fade->queue + LED_FADE_QUEUE * fade->nBytes;
+  fade->from = fade->last + fade->nBytes;
+  fade->to   = fade->from + fade->nBytes;
+  fade->out  = fade->to + fade->nBytes;
+
+  pthread_mutex_init(&fade->lock, 0);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&fade->queued, &attr);
+  pthread_cond_init(&fade->started, &attr);
+  pthread_condattr_destroy(&attr);
+  fade->running = (pthread_create(&fade->thread, 0, renderLoop, fade) == 0);
+  if (!fade->running) {
+    ledFadeDestroy(fade);
+    return 0;
+  }
+  return fade;
+}
+
+/**
+ * Stop the render thread (the current frame is kept on the strip)
+ * and release the engine.
+ */
+void ledFadeDestroy(led_fade_t *fade)
+{
+  if (fade == 0) { return; }
+  pthread_mutex_lock(&fade->lock);
+  fade->stop = 1;
+  pthread_cond_broadcast(&fade->queued);
+  pthread_cond_broadcast(&fade->started);
+  pthread_mutex_unlock(&fade->lock);
+  if (fade->running) {
+    pthread_join(fade->thread, 0);
+  }
+  pthread_cond_destroy(&fade->queued);
+  pthread_cond_destroy(&fade->started);
+  pthread_mutex_destroy(&fade->lock);
+  ledSchedDestroy(fade->sched);
+  free(fade->queue);
+  free(fade);
+}
+
+/**
+ * Queue a keyframe: after the transitions queued before, the strip
+ * fades into these colors in `durationMs`.
+ * If LED_FADE_QUEUE keyframes are waiting, this function waits until
+ * one of them is started.
+ * \param fade        The engine.
+ * \param pixels      count * ledStripBytesPerLed() bytes of colors
+ *                    (see ledStripSetPixels()); the LEDs from `count`
+ *                    keep the colors of the previous keyframe.
+ * \param count       The number of LEDs in `pixels`.
+ * \param order       The order of R,G,B in `pixels`
+ *                    (LED_ORDER_RGB or LED_ORDER_GRB).
+ * \param durationMs  The time of the transition (0: at once).
+ * \param easing      LED_EASE_LINEAR, LED_EASE_IN, etc.
+ * \return  0 for success, -1 for failure.
+ */
+int ledFadeTo(led_fade_t *fade, const unsigned char *pixels, int count,
+              int order, int durationMs, int easing)
+{
+  int nb, i, q;
+  uint8_t *p;
+
+  if (fade == 0 || pixels == 0 || durationMs < 0) { return -1; }
+  nb = ledStripBytesPerLed(fade->strip);
+  if (count > fade->nBytes / nb) { count = fade->nBytes / nb; }
+
+  pthread_mutex_lock(&fade->lock);
+  while (fade->count == LED_FADE_QUEUE && !fade->stop) {
+    pthread_cond_wait(&fade->started, &fade->lock);
+  }
+  if (fade->stop) {
+    pthread_mutex_unlock(&fade->lock);
+    return -1;
+  }
+  /* kept in the order of R,G,B (the order of ledStripSetPixels()) */
+  if (count > 0) {
+    memcpy(fade->last, pixels, count * nb);
+  }
+  if (order != LED_ORDER_RGB) {
+    for (i = 0, p = fade->last; i < count; i++, p += nb) {
+      uint8_t g = p[0];
+      p[0] = p[1];
+      p[1] = g;
+    }
+  }
+  q = (fade->head + fade->count) % LED_FADE_QUEUE;
+  memcpy(fade->queue + fade->nBytes * q, fade->last, fade->nBytes);
+  fade->durationMs[q] = durationMs;
+  fade->easing[q] = easing;
+  fade->count++;
+  pthread_cond_signal(&fade->queued);
+  pthread_mutex_unlock(&fade->lock);
+  return 0;
+}
+
+/**
+ * The number of the keyframes not reached yet
+ * (including the one being faded into).
+ */
+int ledFadePending(led_fade_t *fade)
+{
+  int n;
+  if (fade == 0) { return 0; }
+  pthread_mutex_lock(&fade->lock);
+  n = fade->count + fade->active;
+  pthread_mutex_unlock(&fade->lock);
+  return n;
+}
+
+/**
+ * Wait until all the keyframes queued have been reached.
+ * \param fade       The engine.
+ * \param timeoutMs  Give up after this many milliseconds (-1: never).
+ * \return  0 for success, -1 for timeout or failure.
+ */
+int ledFadeWait(led_fade_t *fade, int timeoutMs)
+{
+  struct timespec ts;
+  int64_t deadline = nowNs() + timeoutMs * 1000000LL;
+  int result = 0;
+
+  if (fade == 0) { return -1; }
+  ts.tv_sec  = deadline / NSEC_PER_SEC;
+  ts.tv_nsec = deadline % NSEC_PER_SEC;
+  pthread_mutex_lock(&fade->lock);
+  while ((fade->count > 0 || fade->active) && !fade->stop) {
+    if (timeoutMs < 0) {
+      pthread_cond_wait(&fade->started, &fade->lock);
+    } else if (pthread_cond_timedwait(&fade->started, &fade->lock,
+                                      &ts) != 0) {
+      result = -1;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&fade->lock);
+  return result;
+}
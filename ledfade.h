@@ -0,0 +1,28 @@
+/*
+ * ledfade.h:
+ * A keyframe engine fading a strip between frames on its own thread.
+ */
+#ifndef LEDFADE_H
+#define LEDFADE_H
+
+#include "serialled.h"
+
+typedef struct led_fade led_fade_t;
+
+/* Easing of a transition (ledFadeTo()) */
+#define LED_EASE_LINEAR  0
+#define LED_EASE_IN      1	/* slow at the start (quadratic) */
+#define LED_EASE_OUT     2	/* slow at the end (quadratic) */
+#define LED_EASE_IN_OUT  3	/* slow at both ends (smoothstep) */
+
+/* The number of keyframes waiting for their transitions */
+#define LED_FADE_QUEUE   8
+
+led_fade_t *ledFadeCreate(led_strip_t *strip, double fps);
+void ledFadeDestroy(led_fade_t *fade);
+int ledFadeTo(led_fade_t *fade, const unsigned char *pixels, int count,
+              int order, int durationMs, int easing);
+int ledFadePending(led_fade_t *fade);
+int ledFadeWait(led_fade_t *fade, int timeoutMs);
+
+#endif /* LEDFADE_H */
@@ -0,0 +1,240 @@
+/*
+ * ledpool.c:
+ * A pool of worker threads running the shards of a job together
+ * (used by serialled.c to encode long frames on several cores).
+ *
+ * The threads stay for the life of the pool.  ledPoolRun() publishes
+ * a job by bumping a generation number; the caller runs shard 0 itself
+ * and waits until every worker has counted the job as done, so the
+ * whole round is a barrier of two atomic counters.  A worker spins on
+ * the generation for SPIN_NS after a job (the next job of a frame, e.g.
+ * the second strip of ledStripCreateDual(), usually comes by then) and
+ * then sleeps on a condition variable, which is signalled only when a
+ * worker is sleeping.
+ *
+ * Copyright (c) 2017 Yoshiaki Takata
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>	/* calloc */
+#include <stdint.h>
+#include <unistd.h>	/* sysconf */
+#include <sched.h>	/* sched_yield */
+#include <time.h>	/* clock_gettime */
+#include <pthread.h>
+
+#include "ledpool.h"
+
+/* a worker spins this long for the next job before sleeping */
+#define SPIN_NS		50000
+
+/* the spinning loops look at the clock once in this many iterations */
+#define SPIN_CHECK	64
+
+#define LOAD(p)        __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define ADD(p, v)      __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+
+typedef struct {
+  led_pool_t *pool;
+  int index;			/* the shard of the worker (1..) */
+  pthread_t thread;
+} worker_t;
+
+struct led_pool {
+  int nThreads;			/* including the caller */
+  worker_t worker[LED_POOL_MAX];	/* 1..nStarted */
+  int nStarted;			/* the workers created */
+
+  /* the job: valid while `gen` is that of the job */
+  led_pool_func_t *func;
+  void *arg;
+  int nShards;
+
+  unsigned int gen;		/* bumped for each job (and to stop) */
+  int done;			/* the workers finished the job */
+  int stop;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;		/* `gen` has been bumped */
+  int sleeping;			/* the workers waiting for `wake` */
+};
+
+static int64_t nowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Wait until the generation differs from `seen`.
+ * \return  The new generation.
+ */
+static unsigned int waitJob(led_pool_t *pool, unsigned int seen)
+{
+  int64_t until = nowNs() + SPIN_NS;
+  unsigned int gen;
+  int i = 0;
+
+  while ((gen = LOAD(&pool->gen)) == seen) {
+    if (++i % SPIN_CHECK == 0 && nowNs() > until) {
+      pthread_mutex_lock(&pool->lock);
+      ADD(&pool->sleeping, 1);
+      while ((gen = LOAD(&pool->gen)) == seen) {
+        pthread_cond_wait(&pool->wake, &pool->lock);
+      }
+      ADD(&pool->sleeping, -1);
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+  }
+  return gen;
+}
+
+static void *workerLoop(void *arg)
+{
+  const worker_t *w = arg;
+  led_pool_t *pool = w->pool;
+  unsigned int seen = 0;
+
+  for (;;) {
+    seen = waitJob(pool, seen);
+    if (LOAD(&pool->stop)) { break; }
+    if (w->index < pool->nShards) {
+      pool->func(pool->arg, w->index, pool->nShards);
+    }
+    ADD(&pool->done, 1);
+  }
+  return 0;
+}
+
+/**
+ * Create a pool.
+ * \param nThreads  The threads running a job, including the caller of
+ *                  ledPoolRun() (1..LED_POOL_MAX; 0 for ledPoolCpus()).
+ * \return  The pool; 0 for failure.
+ */
+led_pool_t *ledPoolCreate(int nThreads)
+{
+  led_pool_t *pool;
+  int i;
+
+  if (nThreads == 0) { nThreads = ledPoolCpus(); }
+  if (nThreads < 1 || nThreads > LED_POOL_MAX) { return 0; }
+  pool = calloc(1, sizeof(led_pool_t));
+  if (pool == 0) { return 0; }
+  pool->nThreads = nThreads;
+  pthread_mutex_init(&pool->lock, 0);
+  pthread_cond_init(&pool->wake, 0);
+  for (i = 1; i < nThreads; i++) {
+    pool->worker[i].pool = pool;
+    pool->worker[i].index = i;
+    if (pthread_create(&pool->worker[i].thread, 0, workerLoop,
+                       &pool->worker[i]) != 0) {
+      ledPoolDestroy(pool);
+      return 0;
+    }
+    pool->nStarted = i;
+  }
+  return pool;
+}
+
+/**
+ * Stop the workers and free a pool.
+ */
+void ledPoolDestroy(led_pool_t *pool)
+{
+  int i;
+
+  if (pool == 0) { return; }
+  STORE(&pool->stop, 1);
+  pthread_mutex_lock(&pool->lock);
+  ADD(&pool->gen, 1);
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for (i = 1; i <= pool->nStarted; i++) {
+    pthread_join(pool->worker[i].thread, 0);
+  }
+  pthread_cond_destroy(&pool->wake);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool);
+}
+
+/**
+ * The threads running a job (including the caller).
+ */
+int ledPoolThreads(const led_pool_t *pool)
+{
+  return (pool == 0 ? 1 : pool->nThreads);
+}
+
+/**
+ * Run func(arg, shard, nShards) for shard 0..nShards-1 in parallel,
+ * and return when all of them have finished.
+ * The caller runs shard 0.  Only one thread may run jobs of a pool.
+ * \param pool     The pool (0: run all the shards in the caller).
+ * \param nShards  1..: at most ledPoolThreads() shards are run.
+ */
+void ledPoolRun(led_pool_t *pool, led_pool_func_t *func, void *arg,
+                int nShards)
+{
+  int64_t until;
+  int i = 0, s;
+
+  if (pool == 0 || pool->nThreads == 1 || nShards <= 1) {
+    for (s = 0; s < nShards; s++) {
+      func(arg, s, nShards);
+    }
+    return;
+  }
+  if (nShards > pool->nThreads) { nShards = pool->nThreads; }
+  pool->func = func;
+  pool->arg = arg;
+  pool->nShards = nShards;
+  STORE(&pool->done, 0);
+  ADD(&pool->gen, 1);
+  if (LOAD(&pool->sleeping) > 0) {
+    pthread_mutex_lock(&pool->lock);
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  func(arg, 0, nShards);
+
+  /* every worker counts the job, so that none is left behind on it */
+  until = nowNs() + SPIN_NS;
+  while (LOAD(&pool->done) < pool->nThreads - 1) {
+    if (++i % SPIN_CHECK == 0 && nowNs() > until) {
+      sched_yield();	/* the workers may be waiting for a core */
+    }
+  }
+}
+
+/**
+ * The number of the online CPUs (1..LED_POOL_MAX).
+ */
+int ledPoolCpus(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) { n = 1; }
+  if (n > LED_POOL_MAX) { n = LED_POOL_MAX; }
+  return (int)n;
+}
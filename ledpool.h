@@ -0,0 +1,24 @@
+/*
+ * ledpool.h:
+ * A pool of worker threads running the shards of a job together
+ * (used by serialled.c to encode long frames on several cores).
+ */
+#ifndef LEDPOOL_H
+#define LEDPOOL_H
+
+typedef struct led_pool led_pool_t;
+
+/* A shard of a job: shard 0..nShards-1 */
+typedef void led_pool_func_t(void *arg, int shard, int nShards);
+
+/* The threads of a pool are at most this (including the caller) */
+#define LED_POOL_MAX  8
+
+led_pool_t *ledPoolCreate(int nThreads);
+void ledPoolDestroy(led_pool_t *pool);
+int ledPoolThreads(const led_pool_t *pool);
+void ledPoolRun(led_pool_t *pool, led_pool_func_t *func, void *arg,
+                int nShards);
+int ledPoolCpus(void);
+
+#endif /* LEDPOOL_H */
@@ -0,0 +1,460 @@
+/*
+ * E1.31 (sACN) や Art-Net で受けた色をLEDテープに送るよ
+ * A receiver of E1.31 (sACN) and Art-Net driving a strip directly.
+ *
+ * The DMX data of each universe is written straight into the colors
+ * of a range of LEDs (ledStripSetPixels(); only the changed LEDs are
+ * encoded into the DMA buffer), and a frame is sent:
+ *  - on a synchronization packet (E1.31 sync, ArtSync), if the data
+ *    asks for it (E1.31) or sync packets are coming (Art-Net);
+ *  - otherwise, when all the universes of the strip have arrived,
+ *    when a universe arrives again, or when no packet comes for
+ *    IDLE_MS.
+ * The packets are received by recvmmsg() in batches, with the kernel
+ * time stamps for measuring the latency from the arrival of a packet
+ * to the start of the DMA (-v).
+ *
+ * $ make ledrecv
+ * $ sudo ./ledrecv -n 6800 -u 1             # universes 1..40 (170 LEDs each)
+ * $ ./ledrecv -b sim -n 680 -v 1            # on the simulated backend
+ *
+ * Options:
+ *   -g gpio     GPIO-number (default 18)
+ *   -n leds     the number of LEDs (default 170)
+ *   -m mode     ms (default) or serial
+ *   -c chip     ws2812b (default), sk6812 (RGBW), ws2811, or apa106
+ *   -u first    the universe of LED 0 (default 1; the port-address
+ *               for Art-Net)
+ *   -l leds     LEDs per universe (default 170, or 128 for RGBW)
+ *   -o order    the order in the DMX data: rgb (default) or grb
+ *   -p proto    e131, artnet, or both (default)
+ *   -a addr     the local IPv4 address to listen on (default any)
+ *   -b backend  hw (default) or sim
+ *   -r prio     run in SCHED_FIFO with this priority (and lock memory)
+ *   -v sec      print the statistics every `sec` seconds
+ */
+
+#define _GNU_SOURCE	/* recvmmsg */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>	/* getopt */
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>	/* sched_setscheduler */
+#include <time.h>
+#include <sys/mman.h>	/* mlockall */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "serialled.h"
+#include "pwmfifo.h"
+
+/* UDP ports */
+#define E131_PORT	5568
+#define ARTNET_PORT	6454
+
+/* the packets received by a call of recvmmsg() */
+#define BATCH		64
+#define PACKET_SIZE	700	/* E1.31: 638 bytes at most */
+
+/* the receive buffer of a socket, for the packets arriving while
+ * ledStripSend() waits for the previous frame */
+#define RCVBUF_SIZE	(1 << 20)
+
+/* send the pending data if no packet comes for this long */
+#define IDLE_MS		20
+
+/* Art-Net: forget ArtSync if none comes for this long (the spec) */
+#define ARTSYNC_TIMEOUT_MS	4000
+
+/* the maximum number of universes of a strip */
+#define MAX_UNIVERSES	512
+
+/* E1.31 (ANSI E1.31-2016) */
+#define E131_ROOT_DATA		0x00000004
+#define E131_ROOT_EXTENDED	0x00000008
+#define E131_FRAME_DATA		0x00000002
+#define E131_EXT_SYNC		0x00000001
+#define E131_OPT_PREVIEW	0x80
+#define E131_DATA_OFFSET	126	/* DMX data after the start code */
+#define E131_SYNC_SIZE		49
+
+/* Art-Net 4 */
+#define ARTNET_OP_DMX		0x5000
+#define ARTNET_OP_SYNC		0x5200
+#define ARTNET_DATA_OFFSET	18
+
+static const char e131Id[12] = "ASC-E1.17\0\0";
+static const char artnetId[8] = "Art-Net";
+
+/* the state of the receiver */
+static led_strip_t *strip;
+static int firstUniverse = 1, nUniverses, ledsPerUniverse;
+static int order = LED_ORDER_RGB;
+static int bytesPerLed;
+static uint8_t seen[MAX_UNIVERSES];	/* arrived since the last frame */
+static int nSeen;
+static int8_t lastSeq[MAX_UNIVERSES];	/* E1.31 sequence numbers */
+static uint8_t hasSeq[MAX_UNIVERSES];
+static int pending;			/* data not sent yet */
+static int64_t pendingSince;		/* the arrival of its first packet */
+static int e131Sync;			/* the sync address of the data */
+static int64_t artSyncAt = -1;		/* the last ArtSync (ns) */
+
+/* statistics */
+static unsigned long nPackets, nFrames, nDropped;
+static int64_t latencySum, latencyMax;
+
+static volatile int stop;
+
+static void onSignal(int signum)
+{
+  stop = 1;
+  signum = signum;	/* suppress 'unused' warning */
+}
+
+/* CLOCK_REALTIME, the clock of SO_TIMESTAMPNS */
+static int64_t nowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int get16(const uint8_t *p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/** Send the data received so far */
+static void sendFrame(void)
+{
+  int64_t latency;
+
+  if (!pending) { return; }
+  ledStripSend(strip);
+  latency = nowNs() - pendingSince;
+  latencySum += latency;
+  if (latency > latencyMax) { latencyMax = latency; }
+  nFrames++;
+  pending = 0;
+  memset(seen, 0, nUniverses);
+  nSeen = 0;
+}
+
+/**
+ * Write the DMX data of a universe into the colors of its LEDs.
+ * \param t  The arrival of the packet (ns).
+ */
+static void putUniverse(int universe, const uint8_t *data, int len,
+                        int64_t t)
+{
+  int u = universe - firstUniverse;
+  int count = len / bytesPerLed;
+
+  if (u < 0 || u >= nUniverses) { return; }
+  if (seen[u] && !e131Sync && artSyncAt < 0) {
+    sendFrame();	/* the next frame has begun */
+  }
+  if (count > ledsPerUniverse) { count = ledsPerUniverse; }
+  ledStripSetPixels(strip, u * ledsPerUniverse, count, data, order);
+  if (!pending) {
+    pending = 1;
+    pendingSince = t;
+  }
+  if (!seen[u]) {
+    seen[u] = 1;
+    nSeen++;
+  }
+}
+
+/** Whether data should wait for a sync packet */
+static int waitsForSync(int64_t t)
+{
+  if (artSyncAt >= 0 && t - artSyncAt > ARTSYNC_TIMEOUT_MS * 1000000LL) {
+    artSyncAt = -1;	/* the console stopped sending ArtSync */
+  }
+  return (e131Sync != 0 || artSyncAt >= 0);
+}
+
+static void handleE131(const uint8_t *p, int len, int64_t t)
+{
+  uint32_t root;
+  int universe, u, count;
+
+  if (len < E131_SYNC_SIZE || memcmp(p + 4, e131Id, 12) != 0) { return; }
+  root = get32(p + 18);
+  if (root == E131_ROOT_EXTENDED && get32(p + 40) == E131_EXT_SYNC) {
+    if (e131Sync != 0 && get16(p + 45) == e131Sync) {
+      sendFrame();
+    }
+    return;
+  }
+  if (root != E131_ROOT_DATA || len <= E131_DATA_OFFSET ||
+      get32(p + 40) != E131_FRAME_DATA) {
+    return;
+  }
+  if ((p[112] & E131_OPT_PREVIEW) || p[125] != 0) {
+    return;	/* preview data, or not DMX (start code) */
+  }
+  universe = get16(p + 113);
+  u = universe - firstUniverse;
+  if (u >= 0 && u < nUniverses) {
+    /* drop a packet out of order (within 20 of the last) */
+    int8_t d = (int8_t)(p[111] - lastSeq[u]);
+    if (hasSeq[u] && d <= 0 && d > -20) {
+      nDropped++;
+      return;
+    }
+    lastSeq[u] = p[111];
+    hasSeq[u] = 1;
+  }
+  e131Sync = get16(p + 109);
+  count = get16(p + 123) - 1;	/* without the start code */
+  if (count > len - E131_DATA_OFFSET) { count = len - E131_DATA_OFFSET; }
+  putUniverse(universe, p + E131_DATA_OFFSET, count, t);
+}
+
+static void handleArtnet(const uint8_t *p, int len, int64_t t)
+{
+  unsigned int op;
+  int count;
+
+  if (len < 12 || memcmp(p, artnetId, 8) != 0) { return; }
+  op = p[8] | (p[9] << 8);	/* little endian */
+  if (op == ARTNET_OP_SYNC) {
+    artSyncAt = t;
+    sendFrame();
+  } else if (op == ARTNET_OP_DMX && len > ARTNET_DATA_OFFSET) {
+    count = get16(p + 16);
+    if (count > len - ARTNET_DATA_OFFSET) {
+      count = len - ARTNET_DATA_OFFSET;
+    }
+    putUniverse(p[14] | ((p[15] & 0x7f) << 8), p + ARTNET_DATA_OFFSET,
+                count, t);
+  }
+}
+
+/** Open a UDP socket with the kernel time stamps */
+static int openSocket(const char *addr, int port)
+{
+  struct sockaddr_in sa;
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  int on = 1, size = RCVBUF_SIZE;
+
+  if (fd == -1) {
+    perror("socket");
+    return -1;
+  }
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+  memset(&sa, 0, sizeof(sa));
+  sa.sin_family = AF_INET;
+  sa.sin_port = htons(port);
+  sa.sin_addr.s_addr = (addr != 0 ? inet_addr(addr) : htonl(INADDR_ANY));
+  if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) == -1) {
+    perror("bind");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/** Join the multicast groups of E1.31 (239.255.hi.lo); errors are ignored */
+static void joinE131Groups(int fd)
+{
+  int u;
+  for (u = 0; u < nUniverses; u++) {
+    int universe = firstUniverse + u;
+    struct ip_mreq mreq;
+    char group[16];
+    snprintf(group, sizeof(group), "239.255.%d.%d",
+             (universe >> 8) & 0xff, universe & 0xff);
+    mreq.imr_multiaddr.s_addr = inet_addr(group);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+  }
+}
+
+/** Receive a batch of packets from a socket and handle them */
+static void receive(int fd, int e131)
+{
+  static uint8_t bufs[BATCH][PACKET_SIZE];
+  static char ctrl[BATCH][CMSG_SPACE(sizeof(struct timespec))];
+  struct mmsghdr msgs[BATCH];
+  struct iovec iov[BATCH];
+  int i, n;
+
+  for (i = 0; i < BATCH; i++) {
+    iov[i].iov_base = bufs[i];
+    iov[i].iov_len = PACKET_SIZE;
+    memset(&msgs[i].msg_hdr, 0, sizeof(struct msghdr));
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = ctrl[i];
+    msgs[i].msg_hdr.msg_controllen = sizeof(ctrl[i]);
+  }
+  n = recvmmsg(fd, msgs, BATCH, MSG_DONTWAIT, 0);
+  for (i = 0; i < n; i++) {
+    struct cmsghdr *c;
+    int64_t t = 0;
+    for (c = CMSG_FIRSTHDR(&msgs[i].msg_hdr); c != 0;
+         c = CMSG_NXTHDR(&msgs[i].msg_hdr, c)) {
+      if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+        struct timespec ts;
+        memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+        t = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+      }
+    }
+    if (t == 0) { t = nowNs(); }
+    nPackets++;
+    if (e131) {
+      handleE131(bufs[i], msgs[i].msg_len, t);
+    } else {
+      handleArtnet(bufs[i], msgs[i].msg_len, t);
+    }
+  }
+}
+
+static void printStats(void)
+{
+  fprintf(stderr, "%lu packets, %lu frames, %lu dropped, "
+          "latency avg %.3f ms max %.3f ms\n", nPackets, nFrames, nDropped,
+          (nFrames > 0 ? latencySum / 1e6 / nFrames : 0), latencyMax / 1e6);
+  latencySum = latencyMax = 0;
+  nFrames = 0;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-g gpio] [-n leds] [-m ms|serial] [-c chip]"
+          " [-u first] [-l leds]\n          [-o rgb|grb] [-p e131|artnet|both]"
+          " [-a addr] [-b hw|sim] [-r prio] [-v sec]\n", name);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *addr = 0, *proto = "both", *backend = 0;
+  int gpio = 18, nLed = 170, mode = LED_MODE_MS, chip = LED_CHIP_WS2812B;
+  int prio = 0, statSec = 0;
+  struct pollfd fds[2];
+  int isE131[2];
+  int nfds = 0, opt, i;
+  int64_t statAt;
+
+  while ((opt = getopt(argc, argv, "g:n:m:c:u:l:o:p:a:b:r:v:")) != -1) {
+    switch (opt) {
+    case 'g': gpio = atoi(optarg); break;
+    case 'n': nLed = atoi(optarg); break;
+    case 'm':
+      mode = (strcmp(optarg, "serial") == 0 ? LED_MODE_SERIAL : LED_MODE_MS);
+      break;
+    case 'c':
+      chip = ledChipByName(optarg);
+      if (chip == -1) { usage(argv[0]); }
+      break;
+    case 'u': firstUniverse = atoi(optarg); break;
+    case 'l': ledsPerUniverse = atoi(optarg); break;
+    case 'o':
+      order = (strcmp(optarg, "grb") == 0 ? LED_ORDER_GRB : LED_ORDER_RGB);
+      break;
+    case 'p': proto = optarg; break;
+    case 'a': addr = optarg; break;
+    case 'b': backend = optarg; break;
+    case 'r': prio = atoi(optarg); break;
+    case 'v': statSec = atoi(optarg); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (backend != 0 && pwmSetBackend(backend) == -1) { return 1; }
+
+  strip = ledStripCreateChip(gpio, nLed, mode, chip);
+  if (strip == 0) {
+    fprintf(stderr, "cannot create a strip of %d LEDs\n", nLed);
+    return 1;
+  }
+  bytesPerLed = ledStripBytesPerLed(strip);
+  if (ledsPerUniverse <= 0) { ledsPerUniverse = 512 / bytesPerLed; }
+  nUniverses = (nLed + ledsPerUniverse - 1) / ledsPerUniverse;
+  if (nUniverses > MAX_UNIVERSES) {
+    fprintf(stderr, "too many universes (%d)\n", nUniverses);
+    ledStripDestroy(strip);
+    return 1;
+  }
+
+  if (strcmp(proto, "artnet") != 0) {
+    fds[nfds].fd = openSocket(addr, E131_PORT);
+    if (fds[nfds].fd != -1) {
+      joinE131Groups(fds[nfds].fd);
+      isE131[nfds++] = 1;
+    }
+  }
+  if (strcmp(proto, "e131") != 0) {
+    fds[nfds].fd = openSocket(addr, ARTNET_PORT);
+    if (fds[nfds].fd != -1) { isE131[nfds++] = 0; }
+  }
+  if (nfds == 0) {
+    ledStripDestroy(strip);
+    return 1;
+  }
+
+  if (prio > 0) {
+    struct sched_param sp;
+    sp.sched_priority = prio;
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) == -1) {
+      perror("sched_setscheduler");
+    }
+    mlockall(MCL_CURRENT | MCL_FUTURE);
+  }
+  /* instead of the handler of pwmfifo.c: the strip is released below */
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGHUP, onSignal);
+
+  fprintf(stderr, "%d LEDs: universes %d..%d (%d LEDs each)\n", nLed,
+          firstUniverse, firstUniverse + nUniverses - 1, ledsPerUniverse);
+  statAt = nowNs();
+  while (!stop) {
+    int n;
+    for (i = 0; i < nfds; i++) {
+      fds[i].events = POLLIN;
+    }
+    n = poll(fds, nfds, (pending ? IDLE_MS : 1000));
+    if (n == 0) {
+      if (!waitsForSync(nowNs())) { sendFrame(); }
+    }
+    for (i = 0; i < nfds && n > 0; i++) {
+      if (fds[i].revents & POLLIN) {
+        receive(fds[i].fd, isE131[i]);
+      }
+    }
+    /* all the universes have arrived */
+    if (nSeen == nUniverses && !waitsForSync(nowNs())) {
+      sendFrame();
+    }
+    if (statSec > 0 && nowNs() - statAt >= statSec * 1000000000LL) {
+      printStats();
+      statAt = nowNs();
+    }
+  }
+
+  for (i = 0; i < nfds; i++) {
+    close(fds[i].fd);
+  }
+  if (statSec > 0) { printStats(); }
+  ledStripWaitSent(strip, 1000);
+  ledStripClearAll(strip);
+  ledStripWaitSent(strip, 1000);
+  ledStripDestroy(strip);
+  return 0;
+}
@@ -0,0 +1,317 @@
+/*
+ * ledring.c:
+ * A ring of frames in shared memory, from unprivileged processes
+ * (producers) to the process driving the strip (ledserver.c).
+ *
+ * The consumer creates the ring with ledRingCreate() as a POSIX shared
+ * memory object readable and writable by everyone.  A producer opens
+ * it with ledRingOpen(), writes the pixels of a frame straight into a
+ * slot returned by ledRingAcquire() and publishes it with
+ * ledRingPublish(); neither makes a system call nor takes a lock, so
+ * any number of producers (in any language, through ctypes) can
+ * submit frames while the consumer is sending.
+ * The ring is a bounded queue of sequence numbers per slot
+ * (see ledring.h): a producer acquiring a slot must publish it, or the
+ * consumer stops at the slot.  A handle of a producer is for a thread;
+ * open another handle for another thread.
+ *
+ * Copyright (c) 2017 Yoshiaki Takata
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>	/* perror */
+#include <stdlib.h>	/* calloc */
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>	/* ftruncate */
+#include <fcntl.h>	/* O_* */
+#include <sys/mman.h>	/* shm_open, mmap */
+#include <sys/stat.h>	/* fchmod, fstat */
+
+#include "ledring.h"
+
+/* the slots of ledRingCreate() are at most this */
+#define MAX_SLOTS	1024
+
+struct led_ring {
+  led_ring_header_t *header;
+  size_t size;			/* of the mapping */
+  char *name;			/* to be unlinked (the consumer), or 0 */
+  uint32_t pos;			/* the slot acquired (a producer) */
+  int acquired;
+
+  /*
+   * The layout of the header, copied when the ring is created or opened:
+   * anyone can write the shared memory, so it is not trusted after that.
+   */
+  uint32_t nSlots, nLed, bytesPerLed, slotSize, dataOffset;
+};
+
+#define LOAD(p)        __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE(p, v)    __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static led_ring_slot_t *slotAt(const led_ring_t *ring, uint32_t pos)
+{
+  return (led_ring_slot_t *)((char *)ring->header + ring->dataOffset +
+                             (size_t)ring->slotSize *
+                             (pos & (ring->nSlots - 1)));
+}
+
+static size_t roundUp(size_t n)
+{
+  return (n + LED_RING_ALIGN - 1) / LED_RING_ALIGN * LED_RING_ALIGN;
+}
+
+/** Copy the layout from the header */
+static void copyLayout(led_ring_t *ring)
+{
+  const led_ring_header_t *h = ring->header;
+  ring->nSlots = h->nSlots;
+  ring->nLed = h->nLed;
+  ring->bytesPerLed = h->bytesPerLed;
+  ring->slotSize = h->slotSize;
+  ring->dataOffset = h->dataOffset;
+}
+
+/**
+ * Create a ring (for the consumer), replacing an old one of the name.
+ * \param name         The name of the shared memory, e.g. LED_RING_NAME.
+ * \param nSlots       The number of frames queued (rounded up to 2^n).
+ * \param nLed         The number of LEDs of a frame.
+ * \param bytesPerLed  3 (R,G,B), or 4 for RGBW chips.
+ * \return  The ring, or 0 for failure.
+ */
+led_ring_t *ledRingCreate(const char *name, int nSlots, int nLed,
+                          int bytesPerLed)
+{
+  led_ring_t *ring;
+  led_ring_header_t *h;
+  uint32_t slots = 1, slotSize, i;
+  size_t size;
+  int fd;
+
+  if (name == 0 || nSlots <= 0 || nSlots > MAX_SLOTS || nLed <= 0 ||
+      bytesPerLed <= 0) {
+    return 0;
+  }
+  while ((int)slots < nSlots) { slots <<= 1; }
+  slotSize = roundUp(sizeof(led_ring_slot_t) + (size_t)nLed * bytesPerLed);
+  size = roundUp(sizeof(led_ring_header_t)) + (size_t)slotSize * slots;
+
+  ring = calloc(1, sizeof(led_ring_t));
+  if (ring == 0) { return 0; }
+  ring->name = strdup(name);
+  ring->size = size;
+
+  shm_unlink(name);
+  fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+  if (fd == -1) {
+    perror("shm_open");
+    free(ring->name);
+    free(ring);
+    return 0;
+  }
+  fchmod(fd, 0666);	/* regardless of umask: for unprivileged producers */
+  if (ftruncate(fd, size) == -1) {
+    perror("ftruncate");
+    h = MAP_FAILED;
+  } else {
+    h = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  if (h == MAP_FAILED) {
+    shm_unlink(name);
+    free(ring->name);
+    free(ring);
+    return 0;
+  }
+
+  h->nSlots = slots;
+  h->nLed = nLed;
+  h->bytesPerLed = bytesPerLed;
+  h->slotSize = slotSize;
+  h->dataOffset = roundUp(sizeof(led_ring_header_t));
+  ring->header = h;
+  copyLayout(ring);
+  for (i = 0; i < slots; i++) {
+    slotAt(ring, i)->seq = i;
+  }
+  STORE(&h->magic, LED_RING_MAGIC);
+  return ring;
+}
+
+/**
+ * Open the ring created by the consumer (for a producer).
+ * \return  The ring, or 0 if there is no ring of the name.
+ */
+led_ring_t *ledRingOpen(const char *name)
+{
+  led_ring_t *ring;
+  led_ring_header_t *h;
+  struct stat st;
+  int fd;
+
+  if (name == 0) { return 0; }
+  fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1) { return 0; }
+  if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(*h)) {
+    close(fd);
+    return 0;
+  }
+  h = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (h == MAP_FAILED) { return 0; }
+  ring = calloc(1, sizeof(led_ring_t));
+  if (ring == 0) {
+    munmap(h, st.st_size);
+    return 0;
+  }
+  ring->header = h;
+  ring->size = st.st_size;
+  copyLayout(ring);
+  /* slotAt() masks the position with nSlots - 1 */
+  if (LOAD(&h->magic) != LED_RING_MAGIC ||
+      ring->nSlots == 0 || (ring->nSlots & (ring->nSlots - 1)) != 0 ||
+      ring->dataOffset < sizeof(led_ring_header_t) ||
+      ring->slotSize < sizeof(led_ring_slot_t) +
+                       (uint64_t)ring->nLed * ring->bytesPerLed ||
+      ring->dataOffset + (uint64_t)ring->slotSize * ring->nSlots >
+      (uint64_t)st.st_size) {
+    munmap(h, st.st_size);
+    free(ring);
+    return 0;
+  }
+  return ring;
+}
+
+/**
+ * Close a ring; the consumer also removes it, and the producers
+ * get 0 from ledRingAcquire() after that.
+ */
+void ledRingClose(led_ring_t *ring)
+{
+  if (ring == 0) { return; }
+  if (ring->name != 0) {
+    STORE(&ring->header->magic, 0);
+    shm_unlink(ring->name);
+    free(ring->name);
+  }
+  munmap(ring->header, ring->size);
+  free(ring);
+}
+
+/** The number of LEDs of a frame */
+int ledRingLength(const led_ring_t *ring)
+{
+  return (ring == 0 ? 0 : (int)ring->nLed);
+}
+
+/** The number of bytes of a pixel: 3, or 4 for RGBW chips */
+int ledRingBytesPerLed(const led_ring_t *ring)
+{
+  return (ring == 0 ? 0 : (int)ring->bytesPerLed);
+}
+
+/**
+ * Take a free slot for a frame.
+ * Write the pixels (ledRingLength() x ledRingBytesPerLed() bytes at
+ * most) into the slot and publish it by ledRingPublish().
+ * \return  The pixels of the slot, or 0 if the ring is full
+ *          (the consumer is behind) or the consumer has quit.
+ */
+unsigned char *ledRingAcquire(led_ring_t *ring)
+{
+  led_ring_header_t *h;
+
+  if (ring == 0) { return 0; }
+  h = ring->header;
+  if (LOAD(&h->magic) != LED_RING_MAGIC) { return 0; }
+  if (ring->acquired) {
+    return LED_RING_PIXELS(slotAt(ring, ring->pos));
+  }
+  for (;;) {
+    uint32_t pos = __atomic_load_n(&h->head, __ATOMIC_RELAXED);
+    led_ring_slot_t *slot = slotAt(ring, pos);
+    int32_t d = (int32_t)(LOAD(&slot->seq) - pos);
+    if (d == 0) {
+      if (__atomic_compare_exchange_n(&h->head, &pos, pos + 1, 0,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        ring->pos = pos;
+        ring->acquired = 1;
+        return LED_RING_PIXELS(slot);
+      }
+    } else if (d < 0) {
+      __atomic_fetch_add(&h->dropped, 1, __ATOMIC_RELAXED);
+      return 0;		/* full */
+    }
+    /* another producer has taken the slot: try the next one */
+  }
+}
+
+/**
+ * Publish the frame written into the slot of ledRingAcquire().
+ * \param start  The first LED of the pixels.
+ * \param count  The number of LEDs.
+ * \param order  LED_ORDER_RGB or LED_ORDER_GRB (serialled.h).
+ * \return  0, or -1 if no slot has been acquired.
+ */
+int ledRingPublish(led_ring_t *ring, int start, int count, int order)
+{
+  led_ring_slot_t *slot;
+
+  if (ring == 0 || !ring->acquired) { return -1; }
+  if (count > (int)ring->nLed) { count = ring->nLed; }
+  slot = slotAt(ring, ring->pos);
+  slot->start = start;
+  slot->count = (count < 0 ? 0 : count);
+  slot->order = order;
+  STORE(&slot->seq, ring->pos + 1);
+  ring->acquired = 0;
+  return 0;
+}
+
+/**
+ * The oldest frame published (for the consumer).
+ * \return  The slot, or 0 if no frame is waiting.
+ */
+const led_ring_slot_t *ledRingPeek(led_ring_t *ring)
+{
+  uint32_t pos;
+  led_ring_slot_t *slot;
+
+  if (ring == 0) { return 0; }
+  pos = ring->header->tail;
+  slot = slotAt(ring, pos);
+  return (LOAD(&slot->seq) == pos + 1 ? slot : 0);
+}
+
+/** Free the slot of ledRingPeek() for the producers */
+void ledRingRelease(led_ring_t *ring)
+{
+  led_ring_header_t *h;
+  uint32_t pos;
+
+  if (ring == 0) { return; }
+  h = ring->header;
+  pos = h->tail;
+  if (LOAD(&slotAt(ring, pos)->seq) != pos + 1) { return; }
+  STORE(&slotAt(ring, pos)->seq, pos + ring->nSlots);
+  STORE(&h->tail, pos + 1);
+}
@@ -0,0 +1,70 @@
+/*
+ * ledring.h:
+ * A ring of frames in shared memory, from unprivileged processes
+ * (producers) to the process driving the strip (ledserver.c).
+ */
+#ifndef LEDRING_H
+#define LEDRING_H
+
+#include <stdint.h>
+
+typedef struct led_ring led_ring_t;
+
+/* The name of the ring of ledserver.c (under /dev/shm) */
+#define LED_RING_NAME     "/serialled"
+
+#define LED_RING_MAGIC    0x31524c53	/* "SLR1" */
+#define LED_RING_ALIGN    64		/* a cache line */
+
+/*
+ * The layout of the shared memory, for producers not using ledring.c
+ * (all the fields are little endian on the Raspberry Pi):
+ *   led_ring_header_t, then nSlots slots of slotSize bytes
+ *   from dataOffset; a slot is led_ring_slot_t and the pixels.
+ * Slot i of the position p (i = p % nSlots) is free for the producer
+ * reserving p (by CAS of head) if its seq is p, and ready for the
+ * consumer if seq is p + 1; the consumer sets it to p + nSlots.
+ */
+typedef struct {
+  uint32_t magic;	/* LED_RING_MAGIC; 0 after the server has quit */
+  uint32_t nSlots;	/* a power of 2 */
+  uint32_t nLed;
+  uint32_t bytesPerLed;	/* 3 (R,G,B), or 4 (R,G,B,W) */
+  uint32_t slotSize;
+  uint32_t dataOffset;
+  uint32_t dropped;	/* frames not published as the ring was full */
+  uint8_t pad1[LED_RING_ALIGN - 7 * 4];
+  uint32_t head;	/* the next position for producers */
+  uint8_t pad2[LED_RING_ALIGN - 4];
+  uint32_t tail;	/* the next position for the consumer */
+  uint8_t pad3[LED_RING_ALIGN - 4];
+} led_ring_header_t;
+
+typedef struct {
+  uint32_t seq;
+  int32_t start;	/* the first LED of the pixels */
+  int32_t count;	/* the number of LEDs */
+  int32_t order;	/* LED_ORDER_RGB or LED_ORDER_GRB */
+  /* the pixels follow */
+} led_ring_slot_t;
+
+#define LED_RING_PIXELS(slot) \
+  ((unsigned char *)(slot) + sizeof(led_ring_slot_t))
+
+/* the consumer */
+led_ring_t *ledRingCreate(const char *name, int nSlots, int nLed,
+                          int bytesPerLed);
+const led_ring_slot_t *ledRingPeek(led_ring_t *ring);
+void ledRingRelease(led_ring_t *ring);
+
+/* producers */
+led_ring_t *ledRingOpen(const char *name);
+unsigned char *ledRingAcquire(led_ring_t *ring);
+int ledRingPublish(led_ring_t *ring, int start, int count, int order);
+int ledRingLength(const led_ring_t *ring);
+int ledRingBytesPerLed(const led_ring_t *ring);
+
+/* both */
+void ledRingClose(led_ring_t *ring);
+
+#endif /* LEDRING_H */
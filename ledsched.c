@@ -0,0 +1,234 @@
+/*
+ * ledsched.c:
+ * A frame scheduler sending frames at a fixed rate.
+ *
+ * Each frame has an absolute deadline on a grid of the frame period,
+ * and the scheduler sleeps until it by clock_nanosleep(TIMER_ABSTIME),
+ * so the time taken by rendering and encoding does not accumulate.
+ * With LED_SCHED_REALTIME, the grid is aligned to CLOCK_REALTIME
+ * (multiples of the period since the epoch), so all the Raspberry Pis
+ * whose clocks are synchronized by NTP or PTP send their frames together
+ * and agree on the frame numbers.
+ *
+ * Copyright (c) 2017 Yoshiaki Takata
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>	/* calloc */
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>	/* clock_nanosleep */
+
+#include "ledsched.h"
+
+#define NSEC_PER_SEC	1000000000LL
+
+struct led_sched {
+  led_strip_t *strip;	/* 0 for the strip of ledSetup() */
+  clockid_t clock;
+  int64_t period;	/* ns */
+  int64_t next;		/* the deadline of the next frame (ns) */
+  uint64_t frame;	/* the number of the next frame */
+  unsigned long missed;	/* the number of the deadlines missed */
+  led_render_t render;
+  void *renderArg;
+  int64_t lead;		/* render this long before the deadline (ns) */
+  volatile int stop;
+};
+
+static int64_t now(const led_sched_t *sched)
+{
+  struct timespec ts;
+  clock_gettime(sched->clock, &ts);
+  return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void sleepUntil(const led_sched_t *sched, int64_t t)
+{
+  struct timespec ts;
+  ts.tv_sec  = t / NSEC_PER_SEC;
+  ts.tv_nsec = t % NSEC_PER_SEC;
+  while (clock_nanosleep(sched->clock, TIMER_ABSTIME, &ts, 0) == EINTR) {
+    if (sched->stop) { return; }
+  }
+}
+
+/**
+ * If the deadline of the next frame has passed, drop the frames whose
+ * deadlines have passed as well, so that the output stays on the grid.
+ * \return  The number of the deadlines missed.
+ */
+static int catchUp(led_sched_t *sched)
+{
+  int64_t t = now(sched);
+  int64_t late;
+  if (t <= sched->next) { return 0; }
+  late = (t - sched->next) / sched->period;	/* the frames to be dropped */
+  sched->frame += late;
+  sched->next  += late * sched->period;
+  sched->missed += late + 1;
+  return late + 1;
+}
+
+/**
+ * Create a frame scheduler.
+ * \param strip  The strip to which the frames are sent
+ *               (0 for the strip of ledSetup()).
+ * \param fps    Frames per second.
+ * \param flags  0, or LED_SCHED_REALTIME to align the frames
+ *               to the synchronized system clock.
+ * \return  The scheduler; 0 for failure.
+ */
+led_sched_t *ledSchedCreate(led_strip_t *strip, double fps, int flags)
+{
+  led_sched_t *sched;
+  int64_t t;
+
+  if (fps <= 0) { return 0; }
+  sched = calloc(1, sizeof(led_sched_t));
+  if (sched == 0) { return 0; }
+  sched->strip = strip;
+  sched->clock = (flags & LED_SCHED_REALTIME ? CLOCK_REALTIME
+                                             : CLOCK_MONOTONIC);
+  sched->period = (int64_t)(NSEC_PER_SEC / fps + 0.5);
+  if (sched->period <= 0) {
+    free(sched);
+    return 0;
+  }
+  t = now(sched);
+  if (flags & LED_SCHED_REALTIME) {
+    /* the next multiple of the period; frame numbers count from the epoch */
+    sched->frame = t / sched->period + 1;
+    sched->next  = (int64_t)sched->frame * sched->period;
+  } else {
+    sched->frame = 0;
+    sched->next  = t + sched->period;
+  }
+  return sched;
+}
+
+/**
+ * Release a scheduler.
+ */
+void ledSchedDestroy(led_sched_t *sched)
+{
+  free(sched);
+}
+
+/**
+ * Set the render callback called by ledSchedRun().
+ * \param render  Sets the colors of a frame (0 for none).
+ * \param arg     Passed to `render`.
+ * \param leadUs  `render` is called this many microseconds before the
+ *                deadline of the frame; it should exceed the time
+ *                taken by `render` and ledSend().
+ */
+void ledSchedSetRender(led_sched_t *sched, led_render_t render, void *arg,
+                       long leadUs)
+{
+  sched->render = render;
+  sched->renderArg = arg;
+  sched->lead = (int64_t)leadUs * 1000;
+}
+
+/**
+ * Sleep until the deadline of the next frame (without catching up),
+ * and move on to the frame after it.
+ */
+static void waitNext(led_sched_t *sched)
+{
+  sleepUntil(sched, sched->next);
+  sched->frame++;
+  sched->next += sched->period;
+}
+
+/**
+ * Sleep until the deadline of the next frame;
+ * send the frame (ledSend()) just after this function returns.
+ * If the deadline has already passed, the function returns at once
+ * and skips the frames whose deadlines have passed as well.
+ * \return  The number of the deadlines missed (0 if in time).
+ */
+int ledSchedWait(led_sched_t *sched)
+{
+  int missed = catchUp(sched);
+  waitNext(sched);
+  return missed;
+}
+
+/**
+ * Render and send frames at the fixed rate
+ * until ledSchedStop() is called.
+ * \param nFrames  The number of frames to be sent (0 for no limit).
+ * \return  The number of the deadlines missed.
+ */
+int ledSchedRun(led_sched_t *sched, unsigned long nFrames)
+{
+  unsigned long missed = sched->missed;
+  unsigned long n;
+  int late;
+
+  sched->stop = 0;
+  for (n = 0; !sched->stop && (nFrames == 0 || n < nFrames); n++) {
+    /* each frame is counted as missed at most once */
+    late = catchUp(sched);
+    if (sched->render != 0) {
+      sleepUntil(sched, sched->next - sched->lead);
+      if (sched->stop) { break; }
+      sched->render(sched->frame, sched->renderArg);
+      if (late == 0) {
+        catchUp(sched);		/* rendered too slowly */
+      }
+    }
+    waitNext(sched);
+    if (sched->strip != 0) {
+      ledStripSend(sched->strip);
+    } else {
+      ledSend();
+    }
+  }
+  return sched->missed - missed;
+}
+
+/**
+ * Make ledSchedRun() return
+ * (this may be called from another thread or a signal handler).
+ */
+void ledSchedStop(led_sched_t *sched)
+{
+  sched->stop = 1;
+}
+
+/**
+ * The number of the next frame
+ * (counted from the epoch with LED_SCHED_REALTIME).
+ */
+uint64_t ledSchedFrame(const led_sched_t *sched)
+{
+  return sched->frame;
+}
+
+/**
+ * The total number of the deadlines missed.
+ */
+unsigned long ledSchedMissed(const led_sched_t *sched)
+{
+  return sched->missed;
+}
@@ -0,0 +1,29 @@
+/*
+ * ledsched.h:
+ * A frame scheduler sending frames at a fixed rate.
+ */
+#ifndef LEDSCHED_H
+#define LEDSCHED_H
+
+#include <stdint.h>
+#include "serialled.h"
+
+typedef struct led_sched led_sched_t;
+
+/* The render callback: set the colors of frame `frame` (do not send) */
+typedef void (*led_render_t)(uint64_t frame, void *arg);
+
+/* Options of ledSchedCreate() */
+#define LED_SCHED_REALTIME  1	/* align the frames to CLOCK_REALTIME */
+
+led_sched_t *ledSchedCreate(led_strip_t *strip, double fps, int flags);
+void ledSchedDestroy(led_sched_t *sched);
+void ledSchedSetRender(led_sched_t *sched, led_render_t render, void *arg,
+                       long leadUs);
+int ledSchedWait(led_sched_t *sched);
+int ledSchedRun(led_sched_t *sched, unsigned long nFrames);
+void ledSchedStop(led_sched_t *sched);
+uint64_t ledSchedFrame(const led_sched_t *sched);
+unsigned long ledSchedMissed(const led_sched_t *sched);
+
+#endif /* LEDSCHED_H */
@@ -0,0 +1,167 @@
+/*
+ * LEDテープを持ち続けて，ほかのプロセスからフレームを受け取るよ
+ * An output service owning a strip: frames come from other processes
+ * (unprivileged, in any language) through a ring in shared memory
+ * (ledring.c), so that they need neither sudo nor the setup of the DMA.
+ *
+ * The service takes the frames published in the ring, writes them into
+ * the strip by ledStripSetPixels() (only the changed LEDs are
+ * re-encoded), and sends the strip once for all the frames taken
+ * together; while a frame is being sent, the next ones wait in the ring.
+ * It looks at the ring every POLL_US when it is empty.
+ * Anyone can write the ring, so a slot whose LEDs are out of the strip
+ * is dropped (and counted as bad).
+ *
+ * $ make ledserver
+ * $ sudo ./ledserver -n 300 &
+ * $ python3 -c '...ledRingOpen(b"/serialled")...'   (see README.md)
+ *
+ * Options:
+ *   -g gpio     GPIO-number (default 18)
+ *   -n leds     the number of LEDs (default 10)
+ *   -m mode     ms (default) or serial
+ *   -c chip     ws2812b (default), sk6812 (RGBW), ws2811, or apa106
+ *   -s slots    the frames in the ring (default 4)
+ *   -f name     the name of the ring (default /serialled)
+ *   -b backend  hw (default) or sim
+ *   -r prio     run in SCHED_FIFO with this priority (and lock memory)
+ *   -v sec      print the statistics every `sec` seconds
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>	/* getopt */
+#include <signal.h>
+#include <sched.h>	/* sched_setscheduler */
+#include <time.h>
+#include <sys/mman.h>	/* mlockall */
+
+#include "serialled.h"
+#include "pwmfifo.h"
+#include "ledring.h"
+
+/* the interval of looking at the empty ring */
+#define POLL_US		200
+
+static volatile int stop;
+
+static void onSignal(int signum)
+{
+  stop = 1;
+  signum = signum;	/* suppress 'unused' warning */
+}
+
+static int64_t nowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+  fprintf(stderr, "usage: %s [-g gpio] [-n leds] [-m ms|serial] [-c chip]"
+          " [-s slots] [-f name]\n          [-b hw|sim] [-r prio] [-v sec]\n",
+          name);
+  exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *name = LED_RING_NAME, *backend = 0;
+  int gpio = 18, nLed = 10, mode = LED_MODE_MS, chip = LED_CHIP_WS2812B;
+  int slots = 4, prio = 0, statSec = 0, opt;
+  unsigned long nFrames = 0, nSends = 0, nBad = 0;
+  struct timespec poll = { 0, POLL_US * 1000 };
+  led_strip_t *strip;
+  led_ring_t *ring;
+  int64_t statAt;
+
+  while ((opt = getopt(argc, argv, "g:n:m:c:s:f:b:r:v:")) != -1) {
+    switch (opt) {
+    case 'g': gpio = atoi(optarg); break;
+    case 'n': nLed = atoi(optarg); break;
+    case 'm':
+      mode = (strcmp(optarg, "serial") == 0 ? LED_MODE_SERIAL : LED_MODE_MS);
+      break;
+    case 'c':
+      chip = ledChipByName(optarg);
+      if (chip == -1) { usage(argv[0]); }
+      break;
+    case 's': slots = atoi(optarg); break;
+    case 'f': name = optarg; break;
+    case 'b': backend = optarg; break;
+    case 'r': prio = atoi(optarg); break;
+    case 'v': statSec = atoi(optarg); break;
+    default:  usage(argv[0]);
+    }
+  }
+  if (backend != 0 && pwmSetBackend(backend) == -1) { return 1; }
+
+  strip = ledStripCreateChip(gpio, nLed, mode, chip);
+  if (strip == 0) {
+    fprintf(stderr, "cannot create a strip of %d LEDs\n", nLed);
+    return 1;
+  }
+  ring = ledRingCreate(name, slots, nLed, ledStripBytesPerLed(strip));
+  if (ring == 0) {
+    fprintf(stderr, "cannot create the ring %s\n", name);
+    ledStripDestroy(strip);
+    return 1;
+  }
+
+  if (prio > 0) {
+    struct sched_param sp;
+    sp.sched_priority = prio;
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) == -1) {
+      perror("sched_setscheduler");
+    }
+    mlockall(MCL_CURRENT | MCL_FUTURE);
+  }
+  /* instead of the handler of pwmfifo.c: the strip is released below */
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGHUP, onSignal);
+
+  fprintf(stderr, "%d LEDs: ring %s of %d frames\n", nLed, name, slots);
+  statAt = nowNs();
+  while (!stop) {
+    const led_ring_slot_t *slot;
+    int n = 0;
+    while ((slot = ledRingPeek(ring)) != 0) {
+      /* read once: a producer may change the slot after the check */
+      int32_t start = *(volatile const int32_t *)&slot->start;
+      int32_t count = *(volatile const int32_t *)&slot->count;
+      int32_t order = *(volatile const int32_t *)&slot->order;
+      if (start < 0 || start >= nLed || count < 0 || count > nLed - start) {
+        nBad++;
+      } else {
+        ledStripSetPixels(strip, start, count, LED_RING_PIXELS(slot), order);
+        n++;
+      }
+      ledRingRelease(ring);
+    }
+    if (n > 0) {
+      ledStripSend(strip);
+      nFrames += n;
+      nSends++;
+    } else {
+      nanosleep(&poll, 0);
+    }
+    if (statSec > 0 && nowNs() - statAt >= statSec * 1000000000LL) {
+      fprintf(stderr, "%lu frames, %lu sent, %lu bad\n",
+              nFrames, nSends, nBad);
+      nFrames = nSends = nBad = 0;
+      statAt = nowNs();
+    }
+  }
+
+  ledRingClose(ring);
+  ledStripWaitSent(strip, 1000);
+  ledStripClearAll(strip);
+  ledStripWaitSent(strip, 1000);
+  ledStripDestroy(strip);
+  return 0;
+}
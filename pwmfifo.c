@@ -40,93 +40,23 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>	/* calloc, getenv */
+#include <string.h>	/* strcmp */
 #include <fcntl.h>
 #include <stdint.h>	/* uint32_t, etc. */
 #include <unistd.h>	/* usleep */
+#include <errno.h>
+#include <time.h>	/* clock_nanosleep */
 #include <signal.h>	/* sigaction */
 #include <sys/mman.h>
 
 #include "mailbox.h"
 #include "pwmfifo.h"
-
-#ifndef PI_VERSION
-# define PI_VERSION  2	/* RPi 2 and 3 */
-#endif
+#include "pwmhw.h"
 
 #define SUCCESS  0
 #define FAILURE  -1
 
-/*
- * Control-register addresses & values
- * -----------------------------------
- */
-#if PI_VERSION == 1
-# define PERIPHERAL_BASE  0x20000000	/* for RPi 1 (not tested) */
-#else
-# define PERIPHERAL_BASE  0x3f000000	/* for RPi 2, 3 */
-#endif
-
-#define GPIO_BASE	(0x00200000 + PERIPHERAL_BASE)
-#define GPFSEL0		(0x00 /4)
-#define GPSET0		(0x1c /4)
-#define GPCLR0		(0x28 /4)
-#define GPFSEL_ALT0	4
-#define GPFSEL_ALT5	2
-
-#define PWMCLK_BASE	(0x00101000 + PERIPHERAL_BASE)
-#define PWMCLK_CTL	(0xa0 /4)
-#define PWMCLK_DIV	(0xa4 /4)
-#define PWMCLK_PASSWD	0x5a000000
-#define PWMCLK_ENABLE   0x10
-#if NOT_USE_PLL
-# define PWMCLK_SRC     0x1	/* oscillator */
-#else
-# define PWMCLK_SRC     0x6	/* PLLD */
-#endif
-
-
-#define PWM_BASE	(0x0020c000 + PERIPHERAL_BASE)
-#define PWM_CTL		(0x00 /4)
-#define PWM_STA		(0x04 /4)
-#define PWM_DMAC	(0x08 /4)
-#define PWM_RNG1	(0x10 /4)
-#define PWM_DAT1	(0x14 /4)
-#define PWM_FIF1	(0x18 /4)
-#define PWM_RNG2	(0x20 /4)
-#define PWM_DAT2	(0x24 /4)
-#define PWM2_MSMODE	(1<<15)
-#define PWM2_USEFIFO	(1<<13)
-#define PWM2_ENABLE	(1<<8)
-#define PWM1_MSMODE	(1<<7)
-#define PWM_CLRFIFO	(1<<6)
-#define PWM1_USEFIFO	(1<<5)
-#define PWM1_ENABLE	(1<<0)
-#define PWMDMAC_ENABLE	(1<<31)
-#define PWMDMAC_THRSHLD	((7<<8)|(7<<0))
-
-#define TIMER_BASE	(0x00003000 + PERIPHERAL_BASE)
-#define TMCLO		(0x04 /4)
-
-#define DMA_BASE	(0x00007000 + PERIPHERAL_BASE)
-#define DMA_CS		(0x00 /4)
-#define DMA_CONBLK_AD	(0x04 /4)
-#define DMA_DEBUG	(0x20 /4)
-#define DMA_CHANNEL_INC	(0x100/4)
-/* DMA_CS */
-#define DMA_RESET	(1<<31)
-#define DMA_INT		(1<<2)
-#define DMA_END		(1<<1)
-#define DMA_ACTIVE	(1<<0)
-#define DMA_PRIORITY(x)		((x)<<16)
-#define DMA_PANIC_PRIORITY(x)	((x)<<20)
-#define DMA_WAIT_FOR_OUTSTANDING_WRITES	(1<<28)
-/* Transfer Information (TI) in a Control Block */
-#define DMA_NO_WIDE_BURSTS	(1<<26)
-#define DMA_PER_MAP(x)	((x)<<16)	/* peripheral map */
-#define DMA_SRC_INC	(1<<8)
-#define DMA_DEST_DREQ	(1<<6)
-#define DMA_WAIT_RESP	(1<<3)
-
 /*
  * Hardware setting up
  * -------------------
@@ -142,8 +72,15 @@ static volatile uint32_t *pwm;
 static volatile uint32_t *timer;
 static volatile uint32_t *dma;
 
-static int setupDma(void);
-static void cleanupDma(void);
+/* the DMA channel opened by setupGpio() */
+static pwm_dma_t *defaultDma;
+
+/* the size of DMA buffers (in words) for pwmDmaOpen() and setupGpio() */
+#define DMA_DEFAULT_SAMPLES	2040
+
+/* the backend (see pwmSetBackend()) */
+static const pwm_backend_t *backend;
+static const pwm_backend_t hwBackend;
 
 /**
  * An aux function doing mmap
@@ -159,36 +96,85 @@ static void *mmapControlRegs(int fd, off_t offset)
 }
 
 /**
- * Set up this GPIO-manipulation module.
+ * Choose how the registers are accessed.
+ * Call this function before setupPwm(); otherwise the environment
+ * variable SERIALLED_BACKEND chooses it ("hw" if not set).
+ * \param name  "hw" for the real hardware (/dev/mem, sudo required),
+ *              "sim" for the software model in pwmsim.c.
  * \return 0 for success; -1 for failure.
  */
-int setupGpio()
+int pwmSetBackend(const char *name)
 {
-  int fd;
+  if (gpio != 0) {
+    fprintf(stderr, "pwmSetBackend: already set up\n");
+    return FAILURE;
+  }
+  if (name == 0 || strcmp(name, "hw") == 0) {
+    backend = &hwBackend;
+  } else if (strcmp(name, "sim") == 0) {
+    backend = &pwmSimBackend;
+  } else {
+    fprintf(stderr, "pwmSetBackend: unknown backend %s\n", name);
+    return FAILURE;
+  }
+  return SUCCESS;
+}
 
-  /* Open /dev/mem (sudo required) */
-  fd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
-  if (fd == -1) {
-    perror("/dev/mem");
+/**
+ * Map the control registers and reset the PWM.
+ * The registers are mapped only once.
+ * \return 0 for success; -1 for failure.
+ */
+int setupPwm()
+{
+  if (gpio != 0) {
+    return SUCCESS;
+  }
+  if (backend == 0 &&
+      pwmSetBackend(getenv("SERIALLED_BACKEND")) == FAILURE) {
     return FAILURE;
   }
 
-  gpio   = mmapControlRegs(fd, GPIO_BASE);
-  clkman = mmapControlRegs(fd, PWMCLK_BASE);
-  pwm    = mmapControlRegs(fd, PWM_BASE);
-  timer  = mmapControlRegs(fd, TIMER_BASE);
-  dma    = mmapControlRegs(fd, DMA_BASE);
+  gpio   = backend->mapRegs(GPIO_BASE);
+  clkman = backend->mapRegs(PWMCLK_BASE);
+  pwm    = backend->mapRegs(PWM_BASE);
+  timer  = backend->mapRegs(TIMER_BASE);
+  dma    = backend->mapRegs(DMA_BASE);
 
-  if (gpio == MAP_FAILED || clkman == MAP_FAILED ||
-      pwm  == MAP_FAILED || timer  == MAP_FAILED || dma == MAP_FAILED)
-  {
+  if (gpio == 0 || clkman == 0 || pwm == 0 || timer == 0 || dma == 0) {
+    gpio = 0;
     return FAILURE;
   }
 
-  if (setupDma() == FAILURE) {
+  *(pwm + PWM_CTL) = 0;	/* reset PWM */
+  return SUCCESS;
+}
+
+/**
+ * Set up this GPIO-manipulation module
+ * with the default DMA channel.
+ * \return 0 for success; -1 for failure.
+ */
+int setupGpio()
+{
+  return setupGpioSize(DMA_DEFAULT_SAMPLES);
+}
+
+/**
+ * Set up this GPIO-manipulation module with the default DMA channel,
+ * whose memory is allocated for blocks of up to `maxSamples` words.
+ * \return 0 for success; -1 for failure.
+ */
+int setupGpioSize(int maxSamples)
+{
+  if (defaultDma != 0) {
+    fprintf(stderr, "DMA pages already allocated\n");
+    return FAILURE;
+  }
+  defaultDma = pwmDmaOpenSize(-1, maxSamples);
+  if (defaultDma == 0) {
     return FAILURE;
   }
-  *(pwm + PWM_CTL) = 0;	/* reset PWM */
   return SUCCESS;
 }
 
@@ -198,7 +184,8 @@ int setupGpio()
  */
 int cleanupGpio()
 {
-  cleanupDma();
+  pwmDmaClose(defaultDma);
+  defaultDma = 0;
   return SUCCESS;
 }
 
@@ -248,13 +235,74 @@ int pinModePwmFifo(int pin)
   return SUCCESS;
 }
 
+/**
+ * Set the pin mode of two pins to PWM_OUTPUT with being feeded
+ * through FIFO.  Words in the FIFO are taken by the two channels
+ * alternately: the first word goes to `pin1`, the second to `pin2`.
+ * \param pin1  GPIO number for PWM channel 1 (12 or 18).
+ * \param pin2  GPIO number for PWM channel 2 (13 or 19).
+ * \return 0 for success; -1 for failure.
+ */
+int pinModePwmFifoDual(int pin1, int pin2)
+{
+  if (PWM_CH(pin1) != 0 || PWM_CH(pin2) != 1) {
+    fprintf(stderr, "pinModePwmFifoDual: "
+            "pin1 must be GPIO 12 or 18 and pin2 must be GPIO 13 or 19.\n");
+    return FAILURE;
+  }
+  if (pinModePwm(pin1) == FAILURE || pinModePwm(pin2) == FAILURE) {
+    return FAILURE;
+  }
+  *(pwm + PWM_CTL) |= PWM1_USEFIFO | PWM2_USEFIFO;
+  return SUCCESS;
+}
+
+/**
+ * Set the pin mode to OUTPUT (driven low),
+ * e.g. for the DMA writing GPSET0/GPCLR0 (see pwmDmaOpenGpio()).
+ * \param pin  GPIO number (0..31).
+ * \return 0 for success; -1 for failure.
+ */
+int pinModeOutput(int pin)
+{
+  if (pin < 0 || pin > 31) {
+    fprintf(stderr, "pinModeOutput: only GPIO 0..31 are supported.\n");
+    return FAILURE;
+  }
+  *(gpio + GPCLR0) = 1u << pin;
+  *(gpio + GPFSEL0 + pin/10) &= ~(7 << ((pin % 10) * 3));
+  *(gpio + GPFSEL0 + pin/10) |= GPFSEL_OUTPUT << ((pin % 10) * 3);
+  return SUCCESS;
+}
+
+/**
+ * Use PWM channel 1 as a pacer of the DMA: its FIFO takes a word
+ * every `range` clocks (the mark:space mode), and no pin is connected
+ * to it (see pwmDmaOpenGpio()).
+ * \param divider  PWM clock divider.
+ * \param range    The clocks per word.
+ * \return 0 for success; -1 for failure.
+ */
+int pwmSetPacer(unsigned int divider, unsigned int range)
+{
+  if (gpio == 0 || range == 0) {
+    return FAILURE;
+  }
+  *(pwm + PWM_CTL) &= ~(PWM2_USEFIFO | PWM1_SERIAL);
+  *(pwm + PWM_CTL) |= PWM1_USEFIFO | PWM1_MSMODE;
+  pwmSetClock(divider);
+  *(pwm + PWM_RNG1) = range;
+  return SUCCESS;
+}
+
 /**
  * Set the PWM to the balanced mode.
  * \param pin  GPIO number.
  */
 void pwmSetModeBalanced(int pin)
 {
-  *(pwm + PWM_CTL) &= ~(PWM_CH(pin) == 0 ? PWM1_MSMODE : PWM2_MSMODE);
+  *(pwm + PWM_CTL) &= ~(PWM_CH(pin) == 0 ? PWM1_MSMODE | PWM1_SERIAL
+                                         : PWM2_MSMODE | PWM2_SERIAL);
 }
 
 /**
@@ -263,9 +311,22 @@ void pwmSetModeBalanced(int pin)
  */
 void pwmSetModeMS(int pin)
 {
+  *(pwm + PWM_CTL) &= ~(PWM_CH(pin) == 0 ? PWM1_SERIAL : PWM2_SERIAL);
   *(pwm + PWM_CTL) |= (PWM_CH(pin) == 0 ? PWM1_MSMODE : PWM2_MSMODE);
 }
 
+/**
+ * Set the PWM to the serializer mode.
+ * In this mode, each word is shifted out bit by bit (MSB first)
+ * and the range is the number of bits taken from a word.
+ * \param pin  GPIO number.
+ */
+void pwmSetModeSerializer(int pin)
+{
+  *(pwm + PWM_CTL) &= ~(PWM_CH(pin) == 0 ? PWM1_MSMODE : PWM2_MSMODE);
+  *(pwm + PWM_CTL) |= (PWM_CH(pin) == 0 ? PWM1_SERIAL : PWM2_SERIAL);
+}
+
 /**
  * Set PWM clock divider.
  */
@@ -323,6 +384,9 @@ void pwmWrite(int pin, unsigned int data)
  * DMA
  * ----------------
  * We use DMA for putting data sequentially to PWM.
+ * A DMA channel and the memory for it are kept in a pwm_dma_t,
+ * opened by pwmDmaOpen().  The functions without a pwm_dma_t
+ * argument (pwmWriteBlock() etc.) use the one opened by setupGpio().
  */
 
 /* DMA channel used for PWM control (0..14) */
@@ -330,18 +394,27 @@ void pwmWrite(int pin, unsigned int data)
 #define DMA_CHANNEL	5
 
 /*
- * number of memory pages for DMA source and a control block:
- * ((24 * nLed + 40) * sizeof(uint32_t) + sizeof(dma_cb_t)) / PAGE_SIZE
+ * number of DMA buffers (control blocks and DMA source each):
+ * while one buffer is being transmitted, the next one can be filled.
+ * In the streaming mode, the buffers are the slots of the ring.
+ */
+#define N_DMA_BUFS	3
+
+/*
+ * The size of the buffers is given to pwmDmaOpenSize() in words
+ * (e.g. 24 * nLed + 40 for the mark:space mode).
  */
-#define N_DMA_PAGES	2
+#define MAX_DMA_SAMPLES		(1 << 24)
 
-#define MAX_N_DMA_SAMPLES  ((int)(N_DMA_PAGES*PAGE_SIZE-sizeof(dma_cb_t))/4)
+/*
+ * The words of a buffer are transferred by a chain of control blocks
+ * of at most MAX_CB_SAMPLES words each, since TXFR_LEN of the DMA Lite
+ * channels (7..14) has only 16 bits.
+ */
+#define MAX_CB_SAMPLES	(0xfffc / 4)
 
-/* mailbox & memory allocation */
-static int mbox_handle;
-static unsigned int mem_ref;	/* from mem_alloc() */
-static unsigned int bus_addr;	/* from mem_lock() */
-static uint8_t *virtaddr;	/* virtual addr of bus_addr */
+/* the depth of the PWM FIFO (in words) */
+#define PWM_FIFO_SAMPLES	16
 
 /* a const used for mem_alloc */
 /* https://github.com/raspberrypi/firmware/wiki/Mailbox-property-interface */
@@ -349,121 +422,349 @@ static uint8_t *virtaddr;	/* virtual addr of bus_addr */
 #define MEM_FLAG_COHERENT	(2 << 2)
 #define MEM_FLAG_L1_NONALLOCATING	(MEM_FLAG_DIRECT | MEM_FLAG_COHERENT)
 
-#define DMA_CB_ADDR	((dma_cb_t *)virtaddr)
-#define	DMA_SRC_ADDR	((uint32_t *)(virtaddr + sizeof(dma_cb_t)))
-#define PWM_PHYS_BASE	(PWM_BASE - PERIPHERAL_BASE + 0x7e000000)
-#define PWM_PHYS_FIFO	(PWM_PHYS_BASE + 0x18)
-
-/* VC bus addr -> ARM physical addr */
-#define BUS_TO_PHYS(x)  ((x) & 0x3fffffff)
+/*
+ * GPIO mode (see pwmDmaOpenGpio()): a buffer has a control block
+ * for the RESET code and GPIO_CB_PER_SAMPLE blocks per word.
+ */
+#define GPIO_CB_PER_SAMPLE	6
 
+/*
+ * Layout of the memory:
+ *   buffer 0: [control blocks (nCb)] [words (maxSamples)]  (bufSize bytes)
+ *   ...
+ *   buffer N_DMA_BUFS-1
+ *   [RESET control blocks of the ring (N_DMA_BUFS)] [a zero word]
+ *   [the pins of the GPIO mode]
+ */
+#define DMA_CB_ADDR(d,b) ((dma_cb_t *)((d)->virtaddr + (b) * (d)->bufSize))
+#define	DMA_SRC_ADDR(d,b) ((uint32_t *)(DMA_CB_ADDR(d, b) + (d)->nCb))
+#define DMA_RST_CB_ADDR(d,b) \
+	((dma_cb_t *)((d)->virtaddr + N_DMA_BUFS * (d)->bufSize) + (b))
+#define DMA_ZERO_ADDR(d)	((uint32_t *)DMA_RST_CB_ADDR(d, N_DMA_BUFS))
+#define DMA_PINS_ADDR(d)	(DMA_ZERO_ADDR(d) + 1)
 /* ARM virtual addr -> VC bus addr */
-#define VIRT_TO_PHYS(x)	(bus_addr + ((uint8_t *)(x) - virtaddr))
+#define VIRT_TO_PHYS(d,x) ((d)->bus_addr + ((uint8_t *)(x) - (d)->virtaddr))
 
-/* DMA Control Block */
+/*
+ * The waveform of the GPIO mode: each word is a bit for all the pins,
+ * `subbits` PWM words long; the pins are high for `high0` of them
+ * (bit 0) or `high1` (bit 1).  `rst` PWM words lead each transfer.
+ */
 typedef struct {
-  uint32_t info;	/* TI: transfer info */
-  uint32_t src;		/* source address */
-  uint32_t dst;		/* destination address */
-  uint32_t length;	/* number of bytes */
-  uint32_t stride;	/* 2D stride (dst<<16|src) */
-  uint32_t next;	/* next control block */
-  uint32_t pad[2];	/* reserved */
-} dma_cb_t;
+  uint32_t pins;
+  int subbits, high0, high1;
+  int rst;
+} gpio_par_t;
 
-/* control register for a specified channel */
-static volatile uint32_t *dmaCh;
+/* A DMA channel and its memory */
+struct pwm_dma {
+  int channel;
+  volatile uint32_t *regs;	/* control register for the channel */
 
-/**
- * Allocate memory pages of which physical addresses are known.
- * \return 0 for success; -1 for failure.
+  /* memory allocation */
+  void *mem;			/* from backend->allocDma() */
+  unsigned int bus_addr;	/* bus address of the memory */
+  uint8_t *virtaddr;		/* virtual addr of bus_addr */
+  unsigned int memSize;		/* size of the memory */
+
+  /* the size of each buffer (see DMA_CB_ADDR()) */
+  int maxSamples;		/* in words */
+  int nCb;			/* control blocks */
+  unsigned int bufSize;		/* in bytes */
+
+  /* the last control block of each buffer used by the last transfer */
+  dma_cb_t *bufTail[N_DMA_BUFS];
+
+  /* the buffer to be filled next, and the one submitted last (-1: none) */
+  int nextBuf;
+  int lastBuf;
+
+  /* streaming mode (see pwmDmaRingStart()) */
+  int ringActive;
+  int ringRstSamples;		/* length of the RESET code in words */
+  unsigned int ringSeq;		/* the number of committed frames */
+  unsigned int slotSeq[N_DMA_BUFS];	/* ringSeq of each slot */
+
+  /* GPIO mode (par.pins != 0; see pwmDmaOpenGpio()) */
+  gpio_par_t par;
+
+  /* predicted end of the transfers (CLOCK_MONOTONIC in ns) */
+  int64_t bufDone[N_DMA_BUFS];	/* of each buffer */
+  int64_t doneAt;		/* of the last submission */
+
+  struct pwm_dma *link;		/* list of opened channels */
+};
+
+/* opened channels (cleaned up by the signal handler) */
+static pwm_dma_t *dmaList;
+
+/* DMA_CS bits written on every start and pause (mid priority) */
+#define DMA_CS_FLAGS	(DMA_WAIT_FOR_OUTSTANDING_WRITES | \
+                         DMA_PANIC_PRIORITY(8) | DMA_PRIORITY(8))
+
+/*
+ * Hardware backend
+ * ----------------
+ * The registers are mapped from /dev/mem, and the memory for DMA is
+ * allocated by the VideoCore through the mailbox.
  */
-static int allocPagesForDma()
+
+/* memory allocated through the mailbox */
+typedef struct {
+  int mbox_handle;
+  unsigned int mem_ref;		/* from mem_alloc() */
+} hw_mem_t;
+
+static volatile uint32_t *hwMapRegs(uint32_t base)
 {
-  if (virtaddr != 0) {
-    fprintf(stderr, "DMA pages already allocated\n");
-    return FAILURE;
+  void *p;
+  int fd;
+
+  /* Open /dev/mem (sudo required) */
+  fd = open("/dev/mem", O_RDWR | O_SYNC | O_CLOEXEC);
+  if (fd == -1) {
+    perror("/dev/mem");
+    return 0;
+  }
+  p = mmapControlRegs(fd, base);
+  close(fd);
+  return (p == MAP_FAILED ? 0 : p);
+}
+
+static void *hwAllocDma(unsigned int size, unsigned int *busAddr, void **mem)
+{
+  hw_mem_t *m;
+  void *virt;
+
+  m = malloc(sizeof(hw_mem_t));
+  if (m == 0) {
+    perror("malloc");
+    return 0;
   }
 
   /* Use mailbox to communicate with VC */
-  mbox_handle = mbox_open();
-  if (mbox_handle < 0) {
+  m->mbox_handle = mbox_open();
+  if (m->mbox_handle < 0) {
     fprintf(stderr, "Failed to open mailbox\n");
-    return FAILURE;
+    free(m);
+    return 0;
   }
   usleep(1000);
 
   /* Allocate memory */
-  mem_ref = mem_alloc(mbox_handle, N_DMA_PAGES * PAGE_SIZE, PAGE_SIZE,
-                      MEM_FLAG_L1_NONALLOCATING);
-  bus_addr = mem_lock(mbox_handle, mem_ref);
-  virtaddr = mapmem(BUS_TO_PHYS(bus_addr), N_DMA_PAGES * PAGE_SIZE);
+  m->mem_ref = mem_alloc(m->mbox_handle, size, PAGE_SIZE,
+                         MEM_FLAG_L1_NONALLOCATING);
+  if (m->mem_ref == 0) {
+    fprintf(stderr, "Failed to allocate %u bytes for DMA\n", size);
+    mbox_close(m->mbox_handle);
+    free(m);
+    return 0;
+  }
+  *busAddr = mem_lock(m->mbox_handle, m->mem_ref);
+  virt = mapmem(BUS_TO_PHYS(*busAddr), size);
 
 #if DEBUG
-  printf("mem_ref %u\n", mem_ref);
-  printf("bus_addr = %x\n", bus_addr);
-  printf("virtaddr = %p\n", virtaddr);
+  printf("mem_ref %u\n", m->mem_ref);
+  printf("bus_addr = %x\n", *busAddr);
+  printf("virtaddr = %p\n", virt);
 #endif
-  return SUCCESS;
+  *mem = m;
+  return virt;
 }
 
-/** Wait for the DMA channel to be inactive */
-static void waitDmaInactive()
+static void hwFreeDma(void *mem, void *virt, unsigned int size)
 {
-  while ((*(dmaCh + DMA_CS) & DMA_ACTIVE) != 0) {
-    usleep(1);
+  hw_mem_t *m = mem;
+  unmapmem(virt, size);
+  mem_unlock(m->mbox_handle, m->mem_ref);
+  mem_free(m->mbox_handle, m->mem_ref);
+  mbox_close(m->mbox_handle);
+  free(m);
+#if DEBUG
+  printf("mailbox closed\n");
+#endif
+}
+
+static const pwm_backend_t hwBackend = {
+  "hw", hwMapRegs, hwAllocDma, hwFreeDma, 0, 0
+};
+
+#define ROUND_UP_PAGE(x)	(((x) + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE)
+
+/**
+ * Allocate memory pages of which physical addresses are known,
+ * for buffers of `maxSamples` words.
+ * \return 0 for success; -1 for failure.
+ */
+static int allocPagesForDma(pwm_dma_t *d, int maxSamples)
+{
+  d->maxSamples = maxSamples;
+  if (d->par.pins != 0) {
+    d->nCb = 1 + GPIO_CB_PER_SAMPLE * maxSamples;
+  } else {
+    d->nCb = (maxSamples + MAX_CB_SAMPLES - 1) / MAX_CB_SAMPLES;
   }
+  if (d->nCb == 0) { d->nCb = 1; }
+  d->bufSize = ROUND_UP_PAGE(d->nCb * sizeof(dma_cb_t) + 4 * maxSamples);
+  d->memSize = N_DMA_BUFS * d->bufSize +
+               ROUND_UP_PAGE((N_DMA_BUFS + 1) * sizeof(dma_cb_t));
+  d->virtaddr = backend->allocDma(d->memSize, &d->bus_addr, &d->mem);
+  return (d->virtaddr == 0 ? FAILURE : SUCCESS);
+}
+
+/*
+ * Waiting for the DMA
+ * -------------------
+ * Instead of polling the registers all the time, we predict when a
+ * transfer finishes from the number of words and the PWM clock,
+ * sleep until then, and confirm it by polling at POLL_INTERVAL_US.
+ */
+
+/* interval of polling after the predicted time (us) */
+#define POLL_INTERVAL_US  20
+
+/* no timeout */
+#define NO_DEADLINE  INT64_MAX
+
+static int64_t nowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleepUntilNs(int64_t t)
+{
+  struct timespec ts;
+  if (t <= nowNs()) { return; }
+  ts.tv_sec  = t / 1000000000LL;
+  ts.tv_nsec = t % 1000000000LL;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR) {
+    ;
+  }
+}
+
+/**
+ * The time (ns) taken by the PWM to consume `n` words of the FIFO,
+ * computed from the current clock divider and range.
+ */
+static int64_t pwmFifoNs(int n)
+{
+  uint32_t ctl, div, range;
+  int64_t ns;
+
+  if (gpio == 0) { return 0; }
+  ctl = *(pwm + PWM_CTL);
+  div = (*(clkman + PWMCLK_DIV) >> 12) & 0xfff;
+  range = *(pwm + ((ctl & PWM1_USEFIFO) ? PWM_RNG1 : PWM_RNG2));
+  ns = (int64_t)n * range * div * 1000000000LL / PWMCLK_FREQ;
+  if ((ctl & PWM1_USEFIFO) && (ctl & PWM2_USEFIFO)) {
+    ns /= 2;	/* the two channels take words alternately */
+  }
+  return ns;
 }
 
 /**
- * Clean up the memories allocated for DMA
+ * Wait for the DMA channel to be inactive.
+ * \param deadline  Give up at this time (see nowNs()).
+ * \return 0 for success; -1 for timeout.
  */
-static void cleanupDma()
+static int waitDmaInactive(pwm_dma_t *d, int64_t deadline)
 {
+  sleepUntilNs(d->doneAt < deadline ? d->doneAt : deadline);
+  while ((*(d->regs + DMA_CS) & DMA_ACTIVE) != 0) {
+    if (nowNs() >= deadline) { return FAILURE; }
+    usleep(POLL_INTERVAL_US);
+  }
+  return SUCCESS;
+}
+
+/**
+ * Stop the channel and release the memories allocated for DMA
+ */
+static void releaseDma(pwm_dma_t *d)
+{
+  /* stop looping on the last frame */
+  if (d->ringActive) {
+    pwmDmaRingStop(d);
+  }
+
   /* wait for the DMA to finish a current task */
-  waitDmaInactive();
-
-  if (virtaddr != 0) {
-    unmapmem(virtaddr, N_DMA_PAGES * PAGE_SIZE);
-    mem_unlock(mbox_handle, mem_ref);
-    mem_free(mbox_handle, mem_ref);
-    mbox_close(mbox_handle);
-    virtaddr = 0;
-#if DEBUG
-    printf("mailbox closed\n");
-#endif
+  waitDmaInactive(d, NO_DEADLINE);
+
+  if (d->virtaddr != 0) {
+    backend->freeDma(d->mem, d->virtaddr, d->memSize);
+    d->virtaddr = 0;
   }
 }
 
 /** signal handler for cleaning up */
 static void terminationHandler(int signum)
 {
-  cleanupDma();
+  pwm_dma_t *d;
+  for (d = dmaList; d != 0; d = d->link) {
+    releaseDma(d);
+  }
   signum = signum;	/* suppress 'unused' warning */
 }
 
+static void setupGpioChains(pwm_dma_t *d);
+
 /**
- * Set up the DMA controller
+ * Open a DMA channel (see pwmDmaOpenSize()),
+ * in the GPIO mode if `par` is given.
  */
-static int setupDma()
+static pwm_dma_t *openDma(int channel, int maxSamples, const gpio_par_t *par)
 {
   struct sigaction sa;
+  pwm_dma_t *d;
+
+  if (channel < 0) {
+    channel = DMA_CHANNEL;
+  }
+  if (maxSamples < 0 || maxSamples > MAX_DMA_SAMPLES) {
+    fprintf(stderr, "Error: n_samples must be <= %d\n", MAX_DMA_SAMPLES);
+    return 0;
+  }
+  if (setupPwm() == FAILURE) {
+    return 0;
+  }
+  for (d = dmaList; d != 0; d = d->link) {
+    if (d->channel == channel) {
+      fprintf(stderr, "DMA channel %d is already in use\n", channel);
+      return 0;
+    }
+  }
+
+  d = calloc(1, sizeof(pwm_dma_t));
+  if (d == 0) {
+    perror("calloc");
+    return 0;
+  }
+  d->channel = channel;
+  d->lastBuf = -1;
+  if (par != 0) {
+    d->par = *par;
+  }
 
   /* allocate memory used for DMA */
-  if (allocPagesForDma() == FAILURE) {
-    return FAILURE;
+  if (allocPagesForDma(d, maxSamples) == FAILURE) {
+    free(d);
+    return 0;
   }
 
-  /* initialize the DMA channel */
-  if (dma == 0 || dma == MAP_FAILED) {
-    fprintf(stderr, "DMA controller register is not mapped\n");
-    return FAILURE;
+  if (par != 0) {
+    setupGpioChains(d);
   }
-  dmaCh = dma + DMA_CHANNEL_INC * DMA_CHANNEL;
 
-  *(dmaCh + DMA_CS) = DMA_RESET;
+  /* initialize the DMA channel */
+  d->regs = dma + DMA_CHANNEL_INC * channel;
+  *(d->regs + DMA_CS) = DMA_RESET;
   usleep(10);
-  *(dmaCh + DMA_CS) = DMA_INT | DMA_END;  /* clear flags */
+  *(d->regs + DMA_CS) = DMA_INT | DMA_END;  /* clear flags */
+
+  d->link = dmaList;
+  dmaList = d;
 
   /* set a signal handler */
   sa.sa_handler = terminationHandler;
@@ -473,64 +774,650 @@ static int setupDma()
   sigaction(SIGHUP,  &sa, 0);
   sigaction(SIGTERM, &sa, 0);
 
-  return SUCCESS;
+  return d;
 }
 
 /**
- * Create a control block and run DMA.
- * The DMA channel automatically stops after submitting one sequence.
- * \param n_samples  The number of words to be transmitted.
+ * Open a DMA channel for feeding the PWM FIFO,
+ * with buffers of DMA_DEFAULT_SAMPLES words (see pwmDmaOpenSize()).
+ * \param channel  DMA channel (0..14); -1 for the default one.
+ * \return  A handle of the channel; 0 for failure.
  */
-static void startDma(int n_samples)
+pwm_dma_t *pwmDmaOpen(int channel)
 {
-  dma_cb_t *cbp  = DMA_CB_ADDR;
-  uint32_t *srcp = DMA_SRC_ADDR;
+  return pwmDmaOpenSize(channel, DMA_DEFAULT_SAMPLES);
+}
 
-  if (virtaddr == 0) {
-    fprintf(stderr, "Error: dma has not been set up\n");
-    return;
+/**
+ * Open a DMA channel for feeding the PWM FIFO.
+ * The memory for DMA is allocated for transfers of up to `maxSamples`
+ * words (see pwmDmaCapacity()).
+ * \param channel     DMA channel (0..14); -1 for the default one.
+ * \param maxSamples  The maximum number of words of a transfer.
+ * \return  A handle of the channel; 0 for failure.
+ */
+pwm_dma_t *pwmDmaOpenSize(int channel, int maxSamples)
+{
+  return openDma(channel, maxSamples, 0);
+}
+
+/**
+ * Close a DMA channel opened by pwmDmaOpen().
+ * It waits for the channel to finish the current transfer.
+ */
+void pwmDmaClose(pwm_dma_t *d)
+{
+  pwm_dma_t **pp;
+
+  if (d == 0) { return; }
+  for (pp = &dmaList; *pp != 0; pp = &(*pp)->link) {
+    if (*pp == d) {
+      *pp = d->link;
+      break;
+    }
   }
+  releaseDma(d);
+  free(d);
+}
 
+/**
+ * The maximum number of words of a transfer
+ * (given to pwmDmaOpenSize()); 0 if not opened.
+ */
+int pwmDmaCapacity(pwm_dma_t *d)
+{
+  return (d == 0 || d->virtaddr == 0 ? 0 : d->maxSamples);
+}
+
+/**
+ * Fill a control block transferring words to the PWM FIFO.
+ */
+static void setupCb(pwm_dma_t *d, dma_cb_t *cbp, uint32_t *srcp,
+                    int n_samples, int srcInc, dma_cb_t *next)
+{
   cbp->info = /* DMA_NO_WIDE_BURSTS | */ DMA_WAIT_RESP |
-              DMA_DEST_DREQ | DMA_PER_MAP(5) | DMA_SRC_INC;
-  cbp->src = VIRT_TO_PHYS(srcp);
+              DMA_DEST_DREQ | DMA_PER_MAP(5) | (srcInc ? DMA_SRC_INC : 0);
+  cbp->src = VIRT_TO_PHYS(d, srcp);
   cbp->dst = PWM_PHYS_FIFO;
   cbp->length = 4 * n_samples;
   cbp->stride = 0;
-  cbp->next = 0;	/* no next control block */
+  cbp->next = (next == 0 ? 0 : VIRT_TO_PHYS(d, next));
+}
+
+/**
+ * Fill the chain of control blocks of buffer `b` transferring
+ * `n_samples` words, followed by `next`.
+ * \return  The last control block of the chain.
+ */
+static dma_cb_t *setupChain(pwm_dma_t *d, int b, int n_samples,
+                            dma_cb_t *next)
+{
+  dma_cb_t *cbp = DMA_CB_ADDR(d, b);
+  uint32_t *srcp = DMA_SRC_ADDR(d, b);
+
+  for (; n_samples > MAX_CB_SAMPLES; n_samples -= MAX_CB_SAMPLES) {
+    setupCb(d, cbp, srcp, MAX_CB_SAMPLES, 1, cbp + 1);
+    cbp++;
+    srcp += MAX_CB_SAMPLES;
+  }
+  setupCb(d, cbp, srcp, n_samples, 1, next);
+  d->bufTail[b] = cbp;
+  return cbp;
+}
+
+/*
+ * GPIO mode
+ * ----------------
+ * The DMA writes masks of pins to GPSET0 and GPCLR0, and between the
+ * writes it puts zero words into the PWM FIFO, so that the writes are
+ * paced by the PWM (see pwmSetPacer()).  A bit of all the pins is
+ *
+ *   [GPSET0 <- pins] [high0 words to FIFO]
+ *   [GPCLR0 <- the word (the pins sending 0)] [high1 - high0 words]
+ *   [GPCLR0 <- pins] [subbits - high1 words]
+ *
+ * The chain of a buffer is built once for maxSamples words, and
+ * pwmDmaSend() only moves its end.  Each transfer starts with `rst`
+ * words to the FIFO, which fill the FIFO before the first bit (the
+ * DMA runs ahead of the PWM by the depth of the FIFO) and keep the
+ * pins low for the RESET code.
+ */
+
+/** Fill a control block writing a word to a GPIO register */
+static void setupGpioCb(pwm_dma_t *d, dma_cb_t *cbp, uint32_t *srcp,
+                        int reg, dma_cb_t *next)
+{
+  cbp->info = DMA_NO_WIDE_BURSTS | DMA_WAIT_RESP;
+  cbp->src = VIRT_TO_PHYS(d, srcp);
+  cbp->dst = GPIO_PHYS_BASE + 4 * reg;
+  cbp->length = 4;
+  cbp->stride = 0;
+  cbp->next = (next == 0 ? 0 : VIRT_TO_PHYS(d, next));
+}
+
+/** Build the chains of all the buffers for maxSamples words */
+static void setupGpioChains(pwm_dma_t *d)
+{
+  const gpio_par_t *p = &d->par;
+  uint32_t *zero = DMA_ZERO_ADDR(d);
+  int b, i;
+
+  *zero = 0;
+  *DMA_PINS_ADDR(d) = p->pins;
+  for (b = 0; b < N_DMA_BUFS; b++) {
+    dma_cb_t *cbp = DMA_CB_ADDR(d, b);
+    uint32_t *srcp = DMA_SRC_ADDR(d, b);
+
+    setupCb(d, cbp, zero, p->rst, 0, cbp + 1);
+    for (i = 0; i < d->maxSamples; i++) {
+      dma_cb_t *c = cbp + 1 + GPIO_CB_PER_SAMPLE * i;
+      setupGpioCb(d, c,     DMA_PINS_ADDR(d), GPSET0, c + 1);
+      setupCb(d, c + 1, zero, p->high0, 0, c + 2);
+      setupGpioCb(d, c + 2, srcp + i,         GPCLR0, c + 3);
+      setupCb(d, c + 3, zero, p->high1 - p->high0, 0, c + 4);
+      setupGpioCb(d, c + 4, DMA_PINS_ADDR(d), GPCLR0, c + 5);
+      setupCb(d, c + 5, zero, p->subbits - p->high1, 0, c + 6);
+    }
+    cbp[d->nCb - 1].next = 0;
+    d->bufTail[b] = &cbp[d->nCb - 1];
+  }
+}
+
+/**
+ * End the chain of buffer `b` after `n_samples` words
+ * (and restore the end of the last transfer of the buffer).
+ */
+static void endGpioChain(pwm_dma_t *d, int b, int n_samples)
+{
+  dma_cb_t *first = DMA_CB_ADDR(d, b);
+  dma_cb_t *tail = first + GPIO_CB_PER_SAMPLE * n_samples;
+  dma_cb_t *old = d->bufTail[b];
+
+  if (old != tail) {
+    old->next = (old + 1 < first + d->nCb ? VIRT_TO_PHYS(d, old + 1) : 0);
+  }
+  tail->next = 0;
+  d->bufTail[b] = tail;
+}
+
+/** The number of words the PWM takes for a transfer of `n` words */
+static int fifoSamples(pwm_dma_t *d, int n)
+{
+  if (d->par.pins == 0) { return n; }
+  return d->par.rst + d->par.subbits * n;
+}
+
+/**
+ * Open a DMA channel in the GPIO mode: the words of a transfer are
+ * bits of up to 32 strips, clocked out in parallel on the pins,
+ * instead of words for the PWM FIFO (see "GPIO mode" above).
+ * Each bit is `subbits` PWM words long and its waveform is given like
+ * the serializer mode, e.g. 100 (bit 0) and 110 (bit 1): a word has
+ * the pins sending 0.  Set the pins by pinModeOutput() and the rate of
+ * the PWM words by pwmSetPacer().
+ * The streaming mode is not supported.
+ * \param channel     DMA channel (0..14); -1 for the default one.
+ * \param maxSamples  The maximum number of words (bits) of a transfer.
+ * \param pins        The mask of the pins (bit n for GPIO n).
+ * \param subbits     PWM words per bit.
+ * \param code0       The waveform of bit 0 (e.g. 0x4 for 100).
+ * \param code1       The waveform of bit 1 (e.g. 0x6 for 110).
+ * \param rstSamples  PWM words sent low before each transfer.
+ * \return  A handle of the channel; 0 for failure.
+ */
+pwm_dma_t *pwmDmaOpenGpio(int channel, int maxSamples, uint32_t pins,
+                          int subbits, uint32_t code0, uint32_t code1,
+                          int rstSamples)
+{
+  gpio_par_t par;
+  uint32_t all = (subbits >= 32 ? 0xffffffff : (1u << subbits) - 1);
+
+  /* the codes must be high first and then low: 1..10..0 */
+  par.pins = pins;
+  par.subbits = subbits;
+  for (par.high0 = 0; par.high0 < subbits &&
+       ((code0 >> (subbits - 1 - par.high0)) & 1); par.high0++) {
+    ;
+  }
+  for (par.high1 = 0; par.high1 < subbits &&
+       ((code1 >> (subbits - 1 - par.high1)) & 1); par.high1++) {
+    ;
+  }
+  if (pins == 0 || subbits < 2 || subbits > 32 ||
+      par.high0 == 0 || par.high0 >= par.high1 || par.high1 >= subbits ||
+      (code0 & all) != (all & ~(all >> par.high0)) ||
+      (code1 & all) != (all & ~(all >> par.high1))) {
+    fprintf(stderr, "pwmDmaOpenGpio: unsupported waveform\n");
+    return 0;
+  }
+  /* fill the FIFO before the first bit */
+  par.rst = (rstSamples < PWM_FIFO_SAMPLES ? PWM_FIFO_SAMPLES : rstSamples);
+  if (par.rst > MAX_CB_SAMPLES) {
+    fprintf(stderr, "Error: rstSamples must be <= %d\n", MAX_CB_SAMPLES);
+    return 0;
+  }
+  return openDma(channel, maxSamples, &par);
+}
+
+/**
+ * Run DMA from control block `head`.
+ * If the DMA channel is still working, `head` is chained after
+ * `prevTail` (the last block of the previous submission), so that
+ * the data follow without a break; otherwise the channel is started.
+ */
+static void appendDma(pwm_dma_t *d, dma_cb_t *head, dma_cb_t *prevTail)
+{
+  uint32_t cur;
+
+  __sync_synchronize();
+
+  /* Pause the channel so that it does not move to another block */
+  if (backend->lockDma != 0) { backend->lockDma(); }
+  *(d->regs + DMA_CS) = DMA_CS_FLAGS;
+  cur = *(d->regs + DMA_CONBLK_AD);
+
+  if (cur == 0) {
+    /* the channel is idle */
+    *(d->regs + DMA_CONBLK_AD) = VIRT_TO_PHYS(d, head);
+    *(d->regs + DMA_DEBUG) = 7;			/* clear flags */
+  } else {
+    /* append to the chain */
+    prevTail->next = VIRT_TO_PHYS(d, head);
+    if (cur == VIRT_TO_PHYS(d, prevTail)) {
+      /* `prevTail` has already been loaded; modify the loaded copy */
+      *(d->regs + DMA_NEXTCONBK) = VIRT_TO_PHYS(d, head);
+    }
+    __sync_synchronize();
+  }
+  *(d->regs + DMA_CS) = DMA_CS_FLAGS | DMA_ACTIVE;	/* go! */
+  if (backend->unlockDma != 0) { backend->unlockDma(); }
+}
+
+/**
+ * Whether `cur` (the bus address of a control block) belongs to
+ * buffer `b` (including the RESET block of the ring).
+ */
+static int isBufferCb(pwm_dma_t *d, uint32_t cur, int b)
+{
+  uint32_t cb = VIRT_TO_PHYS(d, DMA_CB_ADDR(d, b));
+  return ((cur >= cb && cur < cb + d->nCb * sizeof(dma_cb_t)) ||
+          cur == VIRT_TO_PHYS(d, DMA_RST_CB_ADDR(d, b)));
+}
+
+/** Wait while the DMA channel is working on buffer `b` */
+static void waitDmaBuffer(pwm_dma_t *d, int b)
+{
+  sleepUntilNs(d->bufDone[b]);
+  while (isBufferCb(d, *(d->regs + DMA_CONBLK_AD), b)) {
+    usleep(POLL_INTERVAL_US);
+  }
+}
+
+/**
+ * Get a DMA source buffer for writing data directly into it.
+ * The buffer is not being transmitted; if all the buffers are being
+ * transmitted, wait until the oldest one finishes.
+ * Call pwmDmaSend() after filling the buffer.
+ * \param d  DMA channel.
+ * \param n  The number of words to be written
+ *           (up to pwmDmaCapacity()).
+ * \return  The buffer; 0 if `n` is too large.
+ */
+uint32_t *pwmDmaGetBuffer(pwm_dma_t *d, int n)
+{
+  if (d == 0 || d->virtaddr == 0) {
+    fprintf(stderr, "Error: dma has not been set up\n");
+    return 0;
+  }
+  if (d->ringActive) {
+    fprintf(stderr, "Error: dma is in the streaming mode\n");
+    return 0;
+  }
+  if (n > d->maxSamples) {
+    fprintf(stderr, "Error: n_samples must be <= %d\n", d->maxSamples);
+    return 0;
+  }
+
+  waitDmaBuffer(d, d->nextBuf);
+  return DMA_SRC_ADDR(d, d->nextBuf);
+}
+
+/**
+ * Start transmitting the words written in the buffer
+ * returned by pwmDmaGetBuffer().
+ * The DMA channel automatically stops after the last buffer.
+ * \param d  DMA channel.
+ * \param n  The number of words in the buffer.
+ */
+void pwmDmaSend(pwm_dma_t *d, int n)
+{
+  int64_t start;
+  int b;
+
+  if (d == 0 || d->virtaddr == 0) {
+    fprintf(stderr, "Error: dma has not been set up\n");
+    return;
+  }
+  if (n > d->maxSamples) {
+    fprintf(stderr, "Error: n_samples must be <= %d\n", d->maxSamples);
+    return;
+  }
+  b = d->nextBuf;
+  if (d->par.pins != 0) {
+    endGpioChain(d, b, n);
+  } else {
+    setupChain(d, b, n, 0);
+  }
+  appendDma(d, DMA_CB_ADDR(d, b),
+            d->lastBuf < 0 ? 0 : d->bufTail[d->lastBuf]);
+
+  /* it starts after the previous submission */
+  start = nowNs();
+  if (start < d->doneAt) { start = d->doneAt; }
+  d->doneAt = d->bufDone[b] = start + pwmFifoNs(fifoSamples(d, n));
+
+  d->lastBuf = b;
+  d->nextBuf = (b + 1) % N_DMA_BUFS;
+}
+
+/*
+ * Streaming mode
+ * ----------------
+ * The buffers form a ring and the DMA channel never stops:
+ *
+ *   [data 0] -> [RESET 0] -> [data 1] -> [RESET 1] -> ... -> [data k] <-+
+ *                                                                |     |
+ *                                                             [RESET k]
+ *
+ * Each slot has a control block for its data and another one sending
+ * the RESET code from a single zero word (without incrementing the
+ * source address). The RESET block of the last committed slot points
+ * back to its own data, so the latest frame is repeated until a new
+ * one is committed.
+ */
+
+/**
+ * Start the streaming mode.
+ * Use pwmDmaRingAcquire() and pwmDmaRingCommit() instead of
+ * pwmDmaGetBuffer() and pwmDmaSend() until pwmDmaRingStop().
+ * \param d           DMA channel.
+ * \param rstSamples  The number of zero words sent after each frame.
+ * \return 0 for success; -1 for failure.
+ */
+int pwmDmaRingStart(pwm_dma_t *d, int rstSamples)
+{
+  if (d == 0 || d->virtaddr == 0) {
+    fprintf(stderr, "Error: dma has not been set up\n");
+    return FAILURE;
+  }
+  if (d->par.pins != 0) {
+    fprintf(stderr, "Error: no streaming mode for GPIO\n");
+    return FAILURE;
+  }
+  if (d->ringActive) {
+    return SUCCESS;
+  }
+  waitDmaInactive(d, NO_DEADLINE);
+  *DMA_ZERO_ADDR(d) = 0;
+  d->ringRstSamples = rstSamples;
+  d->ringSeq = 0;
+  d->lastBuf = -1;
+  d->ringActive = 1;
+  return SUCCESS;
+}
+
+/**
+ * Get a slot of the ring for writing a frame.
+ * If the DMA channel is still working on the slot, wait for it.
+ * \param d  DMA channel.
+ * \param n  The number of words to be written.
+ * \return  The buffer of the slot; 0 for failure.
+ */
+uint32_t *pwmDmaRingAcquire(pwm_dma_t *d, int n)
+{
+  if (d == 0 || !d->ringActive) {
+    fprintf(stderr, "Error: dma is not in the streaming mode\n");
+    return 0;
+  }
+  if (n > d->maxSamples) {
+    fprintf(stderr, "Error: n_samples must be <= %d\n", d->maxSamples);
+    return 0;
+  }
+  waitDmaBuffer(d, d->nextBuf);
+  return DMA_SRC_ADDR(d, d->nextBuf);
+}
+
+/**
+ * Publish the slot returned by pwmDmaRingAcquire().
+ * The DMA channel moves to this frame after the current one.
+ * \param d  DMA channel.
+ * \param n  The number of words written in the slot.
+ * \return  The sequence number of the frame (1, 2, ...).
+ */
+unsigned int pwmDmaRingCommit(pwm_dma_t *d, int n)
+{
+  int b;
+
+  if (d == 0 || !d->ringActive) {
+    fprintf(stderr, "Error: dma is not in the streaming mode\n");
+    return 0;
+  }
+  if (n > d->maxSamples) {
+    fprintf(stderr, "Error: n_samples must be <= %d\n", d->maxSamples);
+    return 0;
+  }
+  b = d->nextBuf;
+  setupChain(d, b, n, DMA_RST_CB_ADDR(d, b));
+  setupCb(d, DMA_RST_CB_ADDR(d, b), DMA_ZERO_ADDR(d), d->ringRstSamples, 0,
+          DMA_CB_ADDR(d, b));
+  appendDma(d, DMA_CB_ADDR(d, b),
+            d->lastBuf < 0 ? 0 : DMA_RST_CB_ADDR(d, d->lastBuf));
+
+  d->slotSeq[b] = ++d->ringSeq;
+  d->bufDone[b] = 0;	/* unknown: the frame may be repeated */
+  d->lastBuf = b;
+  d->nextBuf = (b + 1) % N_DMA_BUFS;
+  return d->ringSeq;
+}
 
-  *(dmaCh + DMA_CONBLK_AD) = VIRT_TO_PHYS(cbp);
-  *(dmaCh + DMA_DEBUG) = 7;			/* clear flags */
-  *(dmaCh + DMA_CS) = DMA_WAIT_FOR_OUTSTANDING_WRITES |
-                DMA_PANIC_PRIORITY(8) | DMA_PRIORITY(8) | /* mid priority */
-                DMA_ACTIVE;				  /* go! */
+/**
+ * How far the DMA channel has consumed the ring.
+ * \param d  DMA channel.
+ * \return  The sequence number of the frame being transmitted;
+ *          the frames up to it will never be transmitted again
+ *          (except the latest one, which is repeated).
+ */
+unsigned int pwmDmaRingConsumed(pwm_dma_t *d)
+{
+  uint32_t cur;
+  int b;
+
+  if (d == 0 || d->virtaddr == 0) { return 0; }
+  cur = *(d->regs + DMA_CONBLK_AD);
+  for (b = 0; b < N_DMA_BUFS; b++) {
+    if (isBufferCb(d, cur, b)) {
+      return d->slotSeq[b];
+    }
+  }
+  return d->ringSeq;	/* stopped */
+}
+
+/**
+ * Stop the streaming mode.
+ * The DMA channel stops after the current frame and its RESET code;
+ * this function waits for it.
+ * \param d  DMA channel.
+ */
+void pwmDmaRingStop(pwm_dma_t *d)
+{
+  dma_cb_t *tail;
+
+  if (d == 0 || !d->ringActive) { return; }
+  d->ringActive = 0;
+  if (d->lastBuf < 0) { return; }
+
+  /* break the loop of the last slot */
+  tail = DMA_RST_CB_ADDR(d, d->lastBuf);
+  if (backend->lockDma != 0) { backend->lockDma(); }
+  *(d->regs + DMA_CS) = DMA_CS_FLAGS;	/* pause */
+  tail->next = 0;
+  if (*(d->regs + DMA_CONBLK_AD) == VIRT_TO_PHYS(d, tail)) {
+    *(d->regs + DMA_NEXTCONBK) = 0;
+  }
+  __sync_synchronize();
+  *(d->regs + DMA_CS) = DMA_CS_FLAGS | DMA_ACTIVE;
+  if (backend->unlockDma != 0) { backend->unlockDma(); }
+  d->lastBuf = -1;
+  d->doneAt = 0;	/* unknown: just poll */
+  waitDmaInactive(d, NO_DEADLINE);
+}
+
+/**
+ * Wait until all the words submitted to the channel have been
+ * shifted out of the PWM.  The function sleeps until the predicted
+ * end of the transfer and then confirms it by polling.
+ * In the streaming mode, it waits until the DMA channel has started
+ * the latest committed frame (which is then repeated).
+ * \param d          DMA channel.
+ * \param timeoutMs  Give up after this many milliseconds (-1: never).
+ * \return 0 for success; -1 for timeout or failure.
+ */
+int pwmDmaWaitSent(pwm_dma_t *d, int timeoutMs)
+{
+  int64_t deadline = (timeoutMs < 0 ? NO_DEADLINE
+                                    : nowNs() + timeoutMs * 1000000LL);
+
+  if (d == 0 || d->virtaddr == 0) { return FAILURE; }
+  if (d->ringActive) {
+    while (pwmDmaRingConsumed(d) != d->ringSeq) {
+      if (nowNs() >= deadline) { return FAILURE; }
+      usleep(POLL_INTERVAL_US);
+    }
+    return SUCCESS;
+  }
+  if (waitDmaInactive(d, deadline) == FAILURE) { return FAILURE; }
+
+  /* the last words in the FIFO */
+  while ((*(pwm + PWM_STA) & PWM_STA_EMPT1) == 0) {
+    if (nowNs() >= deadline) { return FAILURE; }
+    usleep(POLL_INTERVAL_US);
+  }
+  return SUCCESS;
+}
+
+/*
+ * The functions for the channel opened by setupGpio()
+ */
+
+/**
+ * The maximum number of words of a block (see pwmDmaCapacity()).
+ */
+int pwmBlockCapacity()
+{
+  return pwmDmaCapacity(defaultDma);
+}
+
+/**
+ * Get the DMA source buffer (see pwmDmaGetBuffer()).
+ * \param n  The number of words to be written.
+ * \return  The buffer; 0 if `n` is too large.
+ */
+uint32_t *pwmGetBlockBuffer(int n)
+{
+  return pwmDmaGetBuffer(defaultDma, n);
+}
+
+/**
+ * Start transmitting the words written in the buffer
+ * returned by pwmGetBlockBuffer().
+ * \param n  The number of words in the buffer.
+ */
+void pwmSendBlock(int n)
+{
+  pwmDmaSend(defaultDma, n);
 }
 
 /**
  * Write the contents of an array into PWM FIFO.
  * \param array  Bytes to be transmitted to the PWM peripheral.
  * \param n      The number of bytes in `array`.
+ * \return 0 for success; -1 if `n` exceeds pwmBlockCapacity().
  */
-void pwmWriteBlock(const unsigned char *array, int n)
+int pwmWriteBlock(const unsigned char *array, int n)
 {
   int i;
-  uint32_t *srcp = DMA_SRC_ADDR;
+  uint32_t *srcp = pwmGetBlockBuffer(n);
 
-  if (n > MAX_N_DMA_SAMPLES) {
-    fprintf(stderr, "Error: n_samples must be <= %d\n", MAX_N_DMA_SAMPLES);
-    return;
+  if (srcp == 0) { return FAILURE; }
+
+  /* Move the data to a space whose physical address is known */
+  for (i = 0; i < n; i++) {
+    srcp[i] = array[i];
   }
 
-  /* If the DMA channel is active, wait for it to finish */
-  waitDmaInactive();
+  /* Start DMA */
+  pwmSendBlock(n);
+  return SUCCESS;
+}
+
+/**
+ * Write words into PWM FIFO.
+ * Unlike pwmWriteBlock(), each element is transmitted as it is
+ * (e.g. 32 bits packed for the serializer mode).
+ * \param array  Words to be transmitted to the PWM peripheral.
+ * \param n      The number of words in `array`.
+ * \return 0 for success; -1 if `n` exceeds pwmBlockCapacity().
+ */
+int pwmWriteWords(const uint32_t *array, int n)
+{
+  int i;
+  uint32_t *srcp = pwmGetBlockBuffer(n);
+
+  if (srcp == 0) { return FAILURE; }
 
-  /* Move the data to a space whose physical address is known */
   for (i = 0; i < n; i++) {
     srcp[i] = array[i];
   }
 
   /* Start DMA */
-  startDma(n);
+  pwmSendBlock(n);
+  return SUCCESS;
+}
+
+/** Streaming mode of the default channel (see pwmDmaRingStart()). */
+int pwmRingStart(int rstSamples)
+{
+  return pwmDmaRingStart(defaultDma, rstSamples);
+}
+
+/** See pwmDmaRingAcquire(). */
+uint32_t *pwmRingAcquire(int n)
+{
+  return pwmDmaRingAcquire(defaultDma, n);
+}
+
+/** See pwmDmaRingCommit(). */
+unsigned int pwmRingCommit(int n)
+{
+  return pwmDmaRingCommit(defaultDma, n);
+}
+
+/** See pwmDmaRingConsumed(). */
+unsigned int pwmRingConsumed()
+{
+  return pwmDmaRingConsumed(defaultDma);
+}
+
+/** See pwmDmaRingStop(). */
+void pwmRingStop()
+{
+  pwmDmaRingStop(defaultDma);
+}
+
+/** See pwmDmaWaitSent(). */
+int pwmWaitSent(int timeoutMs)
+{
+  return pwmDmaWaitSent(defaultDma, timeoutMs);
 }
 
 /**
@@ -539,7 +1426,7 @@ void pwmWriteBlock(const unsigned char *array, int n)
 void pwmWaitFifoEmpty()
 {
   /* wait while not empty */
-  while ((*(pwm + PWM_STA) & 0x2) == 0) {
-    usleep(1);
+  while ((*(pwm + PWM_STA) & PWM_STA_EMPT1) == 0) {
+    usleep(POLL_INTERVAL_US);
   }
 }
@@ -1,12 +1,55 @@
+#ifndef PWMFIFO_H
+#define PWMFIFO_H
+
+#include <stdint.h>
+
+/* A DMA channel feeding the PWM FIFO (see pwmDmaOpen()) */
+typedef struct pwm_dma pwm_dma_t;
+
+int pwmSetBackend(const char *name);
+int setupPwm();
 int setupGpio();
+int setupGpioSize(int maxSamples);
 int cleanupGpio();
 
 int pinModePwm(int pin);
 int pinModePwmFifo(int pin);
+int pinModePwmFifoDual(int pin1, int pin2);
+int pinModeOutput(int pin);
+int pwmSetPacer(unsigned int divider, unsigned int range);
 void pwmSetModeBalanced(int pin);
 void pwmSetModeMS(int pin);
+void pwmSetModeSerializer(int pin);
 void pwmSetClock(unsigned int divider);
 void pwmSetRange(int pin, unsigned int range);
 void pwmWrite(int pin, unsigned int data);
-void pwmWriteBlock(const unsigned char *array, int n);
+int pwmWriteBlock(const unsigned char *array, int n);
+int pwmWriteWords(const uint32_t *array, int n);
+int pwmBlockCapacity();
+uint32_t *pwmGetBlockBuffer(int n);
+void pwmSendBlock(int n);
+int pwmRingStart(int rstSamples);
+uint32_t *pwmRingAcquire(int n);
+unsigned int pwmRingCommit(int n);
+unsigned int pwmRingConsumed();
+void pwmRingStop();
 void pwmWaitFifoEmpty();
+int pwmWaitSent(int timeoutMs);
+
+pwm_dma_t *pwmDmaOpen(int channel);
+pwm_dma_t *pwmDmaOpenSize(int channel, int maxSamples);
+pwm_dma_t *pwmDmaOpenGpio(int channel, int maxSamples, uint32_t pins,
+                          int subbits, uint32_t code0, uint32_t code1,
+                          int rstSamples);
+int pwmDmaCapacity(pwm_dma_t *d);
+void pwmDmaClose(pwm_dma_t *d);
+uint32_t *pwmDmaGetBuffer(pwm_dma_t *d, int n);
+void pwmDmaSend(pwm_dma_t *d, int n);
+int pwmDmaRingStart(pwm_dma_t *d, int rstSamples);
+uint32_t *pwmDmaRingAcquire(pwm_dma_t *d, int n);
+unsigned int pwmDmaRingCommit(pwm_dma_t *d, int n);
+unsigned int pwmDmaRingConsumed(pwm_dma_t *d);
+void pwmDmaRingStop(pwm_dma_t *d);
+int pwmDmaWaitSent(pwm_dma_t *d, int timeoutMs);
+
+#endif /* PWMFIFO_H */
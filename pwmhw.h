@@ -0,0 +1,143 @@
+/*
+ * pwmhw.h:
+ * Addresses and values of the control registers used by pwmfifo.c,
+ * and the backend giving access to them (see pwmSetBackend()).
+ */
+#ifndef PWMHW_H
+#define PWMHW_H
+
+#include <stdint.h>
+
+#ifndef PI_VERSION
+# define PI_VERSION  2	/* RPi 2 and 3 */
+#endif
+
+/*
+ * Control-register addresses & values
+ * -----------------------------------
+ */
+#if PI_VERSION == 1
+# define PERIPHERAL_BASE  0x20000000	/* for RPi 1 (not tested) */
+#else
+# define PERIPHERAL_BASE  0x3f000000	/* for RPi 2, 3 */
+#endif
+
+#define GPIO_BASE	(0x00200000 + PERIPHERAL_BASE)
+#define GPFSEL0		(0x00 /4)
+#define GPSET0		(0x1c /4)
+#define GPCLR0		(0x28 /4)
+#define GPLEV0		(0x34 /4)
+#define GPFSEL_OUTPUT	1
+#define GPFSEL_ALT0	4
+#define GPFSEL_ALT5	2
+
+#define PWMCLK_BASE	(0x00101000 + PERIPHERAL_BASE)
+#define PWMCLK_CTL	(0xa0 /4)
+#define PWMCLK_DIV	(0xa4 /4)
+#define PWMCLK_PASSWD	0x5a000000
+#define PWMCLK_ENABLE   0x10
+#if NOT_USE_PLL
+# define PWMCLK_SRC     0x1	/* oscillator */
+# define PWMCLK_FREQ    19200000
+#else
+# define PWMCLK_SRC     0x6	/* PLLD */
+# define PWMCLK_FREQ    500000000
+#endif
+
+
+#define PWM_BASE	(0x0020c000 + PERIPHERAL_BASE)
+#define PWM_CTL		(0x00 /4)
+#define PWM_STA		(0x04 /4)
+#define PWM_STA_FULL1	(1<<0)
+#define PWM_STA_EMPT1	(1<<1)
+#define PWM_DMAC	(0x08 /4)
+#define PWM_RNG1	(0x10 /4)
+#define PWM_DAT1	(0x14 /4)
+#define PWM_FIF1	(0x18 /4)
+#define PWM_RNG2	(0x20 /4)
+#define PWM_DAT2	(0x24 /4)
+#define PWM2_MSMODE	(1<<15)
+#define PWM2_USEFIFO	(1<<13)
+#define PWM2_SERIAL	(1<<9)
+#define PWM2_ENABLE	(1<<8)
+#define PWM1_MSMODE	(1<<7)
+#define PWM_CLRFIFO	(1<<6)
+#define PWM1_USEFIFO	(1<<5)
+#define PWM1_SERIAL	(1<<1)
+#define PWM1_ENABLE	(1<<0)
+#define PWMDMAC_ENABLE	(1<<31)
+#define PWMDMAC_THRSHLD	((7<<8)|(7<<0))
+
+#define TIMER_BASE	(0x00003000 + PERIPHERAL_BASE)
+#define TMCLO		(0x04 /4)
+
+#define DMA_BASE	(0x00007000 + PERIPHERAL_BASE)
+#define DMA_CS		(0x00 /4)
+#define DMA_CONBLK_AD	(0x04 /4)
+#define DMA_TI		(0x08 /4)	/* loaded from the control block */
+#define DMA_SOURCE_AD	(0x0c /4)
+#define DMA_DEST_AD	(0x10 /4)
+#define DMA_TXFR_LEN	(0x14 /4)
+#define DMA_STRIDE	(0x18 /4)
+#define DMA_NEXTCONBK	(0x1c /4)
+#define DMA_DEBUG	(0x20 /4)
+#define DMA_CHANNEL_INC	(0x100/4)
+/* DMA_CS */
+#define DMA_RESET	(1<<31)
+#define DMA_INT		(1<<2)
+#define DMA_END		(1<<1)
+#define DMA_ACTIVE	(1<<0)
+#define DMA_PRIORITY(x)		((x)<<16)
+#define DMA_PANIC_PRIORITY(x)	((x)<<20)
+#define DMA_WAIT_FOR_OUTSTANDING_WRITES	(1<<28)
+/* Transfer Information (TI) in a Control Block */
+#define DMA_NO_WIDE_BURSTS	(1<<26)
+#define DMA_PER_MAP(x)	((x)<<16)	/* peripheral map */
+#define DMA_SRC_INC	(1<<8)
+#define DMA_DEST_INC	(1<<4)
+#define DMA_DEST_DREQ	(1<<6)
+#define DMA_WAIT_RESP	(1<<3)
+
+#define PWM_PHYS_BASE	(PWM_BASE - PERIPHERAL_BASE + 0x7e000000)
+#define PWM_PHYS_FIFO	(PWM_PHYS_BASE + 0x18)
+#define GPIO_PHYS_BASE	(GPIO_BASE - PERIPHERAL_BASE + 0x7e000000)
+
+/* VC bus addr -> ARM physical addr */
+#define BUS_TO_PHYS(x)  ((x) & 0x3fffffff)
+
+/* DMA Control Block */
+typedef struct {
+  uint32_t info;	/* TI: transfer info */
+  uint32_t src;		/* source address */
+  uint32_t dst;		/* destination address */
+  uint32_t length;	/* number of bytes */
+  uint32_t stride;	/* 2D stride (dst<<16|src) */
+  uint32_t next;	/* next control block */
+  uint32_t pad[2];	/* reserved */
+} dma_cb_t;
+
+/*
+ * Backend:
+ * how pwmfifo.c reaches the registers and the memory for DMA.
+ */
+typedef struct {
+  const char *name;
+
+  /* Map a page of control registers at ARM physical address `base` */
+  volatile uint32_t *(*mapRegs)(uint32_t base);
+
+  /* Allocate `size` bytes of uncached memory for DMA;
+   * its bus address is stored in *busAddr, and a handle for
+   * freeDma() in *mem.  Returns the virtual address or 0. */
+  void *(*allocDma)(unsigned int size, unsigned int *busAddr, void **mem);
+  void (*freeDma)(void *mem, void *virt, unsigned int size);
+
+  /* Called around pausing a DMA channel and patching its chain
+   * (0 if the hardware itself stops the channel). */
+  void (*lockDma)(void);
+  void (*unlockDma)(void);
+} pwm_backend_t;
+
+extern const pwm_backend_t pwmSimBackend;	/* pwmsim.c */
+
+#endif /* PWMHW_H */
@@ -0,0 +1,508 @@
+/*
+ * pwmsim.c:
+ * A software model of the PWM and DMA (the backend "sim").
+ *
+ * The control registers are ordinary memory pages, and a thread plays
+ * the part of the hardware: it runs the DMA channels through their
+ * control blocks, feeds the PWM FIFO, and shifts the words out of it
+ * in real time at the rate given by the clock divider and the range.
+ * Each word shifted out is reported with its time stamp to a sink
+ * (see pwmSimSetSink()) or written to a capture file.
+ *
+ * The model covers what pwmfifo.c uses: DMA control-block chains with
+ * DREQ to the PWM FIFO (or memory-to-memory copies), DMA writes to
+ * GPSET0/GPCLR0, pause/resume by DMA_ACTIVE, NEXTCONBK patching,
+ * the mark:space and serializer modes, and one or two channels taking
+ * words from the FIFO alternately.
+ * A DMA write to the GPIO takes effect when the DMA gets to it: when
+ * the PWM takes a word and makes room in the FIFO, or at once if there
+ * is room (so writes not paced by the FIFO come out in a burst).
+ * Bus contention and the timing of DREQ are not modelled: the FIFO
+ * is refilled as soon as a word leaves it.
+ *
+ * Copyright (c) 2017 Yoshiaki Takata
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>	/* posix_memalign, getenv */
+#include <string.h>	/* memset */
+#include <time.h>
+#include <pthread.h>
+
+#include "pwmhw.h"
+#include "pwmsim.h"
+
+#define PAGE_SIZE	4096
+
+/* interval of the model thread (us): while working, and while idle */
+#define SIM_TICK_US	50
+#define SIM_IDLE_US	1000
+
+/* the PWM FIFO (words) */
+#define FIFO_DEPTH	16
+
+/* the number of DMA channels */
+#define N_DMA_CH	15
+
+/* the bus addresses given to the memory for DMA */
+#define SIM_BUS_BASE	0xc0000000
+
+#define MAX_PAGES	8
+#define MAX_REGIONS	16
+
+/* samples passed to the sink at once */
+#define SAMPLE_BUF	256
+
+/* the register pages */
+static struct {
+  uint32_t base;
+  uint32_t *p;
+} pages[MAX_PAGES];
+static int nPages;
+
+/* the memory for DMA */
+static struct {
+  uint8_t *virt;
+  uint32_t bus;
+  uint32_t size;
+} regions[MAX_REGIONS];
+static uint32_t nextBus = SIM_BUS_BASE;
+
+/* the state of the hardware */
+static uint32_t fifo[FIFO_DEPTH];
+static int fifoHead, fifoCount;
+static int fifoNextCh;		/* the channel taking the next word (dual) */
+static int dmaLoaded[N_DMA_CH];	/* a control block has been loaded */
+static int64_t pwmTime;		/* when the PWM takes the next word (ns) */
+static uint64_t words[2];	/* words shifted out by each channel */
+
+/* the output */
+static pwm_sim_sink_t outSink;
+static void *outArg;
+static FILE *capture;
+static pwm_sim_sample_t samples[SAMPLE_BUF];
+static int nSamples;
+
+/* the model thread; the lock is held while it works */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup;
+static int running;
+
+static int64_t nowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/** The register page at `base` (0 if not mapped) */
+static uint32_t *regsAt(uint32_t base)
+{
+  int i;
+  for (i = 0; i < nPages; i++) {
+    if (pages[i].base == base) { return pages[i].p; }
+  }
+  return 0;
+}
+
+/** Bus address -> virtual address (0 if not allocated) */
+static void *busToVirt(uint32_t bus)
+{
+  int i;
+  for (i = 0; i < MAX_REGIONS; i++) {
+    if (regions[i].virt != 0 &&
+        bus >= regions[i].bus && bus - regions[i].bus < regions[i].size) {
+      return regions[i].virt + (bus - regions[i].bus);
+    }
+  }
+  return 0;
+}
+
+/** Pass the buffered samples to the sink and the capture file */
+static void flushSamples(void)
+{
+  if (nSamples == 0) { return; }
+  if (outSink != 0) {
+    outSink(samples, nSamples, outArg);
+  }
+  if (capture != 0) {
+    fwrite(samples, sizeof(pwm_sim_sample_t), nSamples, capture);
+  }
+  nSamples = 0;
+}
+
+/** Stop a DMA channel with an error (like the DEBUG register would) */
+static void dmaError(volatile uint32_t *r, int ch, const char *what,
+                     uint32_t addr)
+{
+  fprintf(stderr, "pwmsim: DMA channel %d: %s %08x\n", ch, what, addr);
+  r[DMA_CS] &= ~DMA_ACTIVE;
+  dmaLoaded[ch] = 0;
+}
+
+/** Apply a DMA write to a GPIO register at time `t` */
+static void writeGpio(uint32_t reg, uint32_t value, int64_t t)
+{
+  uint32_t *gpio = regsAt(GPIO_BASE);
+  pwm_sim_sample_t *s;
+  uint32_t level;
+
+  if (gpio == 0) { return; }
+  level = gpio[GPLEV0];
+  if (reg == GPSET0) {
+    level |= value;
+  } else if (reg == GPCLR0) {
+    level &= ~value;
+  } else {
+    return;	/* other registers are ignored */
+  }
+  if (level == gpio[GPLEV0]) { return; }
+  gpio[GPLEV0] = level;
+
+  s = &samples[nSamples++];
+  memset(s, 0, sizeof(*s));
+  s->t = t;
+  s->word = level;
+  s->ch = PWM_SIM_GPIO;
+  if (nSamples == SAMPLE_BUF) { flushSamples(); }
+}
+
+/**
+ * Run DMA channel `ch` until it finishes its chain
+ * or waits for room in the PWM FIFO.
+ * \param t  The time (ns) of the writes to the GPIO.
+ */
+static void runDma(uint32_t *dmaRegs, int ch, int64_t t)
+{
+  volatile uint32_t *r = dmaRegs + DMA_CHANNEL_INC * ch;
+
+  for (;;) {
+    uint32_t cs = r[DMA_CS];
+    uint32_t *src, *dst;
+
+    if (cs & DMA_RESET) {
+      r[DMA_CS] = 0;
+      r[DMA_CONBLK_AD] = 0;
+      dmaLoaded[ch] = 0;
+      return;
+    }
+    if ((cs & DMA_ACTIVE) == 0) { return; }
+
+    /* load the control block */
+    if (!dmaLoaded[ch]) {
+      dma_cb_t *cb;
+      if (r[DMA_CONBLK_AD] == 0) {
+        r[DMA_CS] = (cs & ~DMA_ACTIVE) | DMA_END;
+        return;
+      }
+      cb = busToVirt(r[DMA_CONBLK_AD]);
+      if (cb == 0) {
+        dmaError(r, ch, "bad control block", r[DMA_CONBLK_AD]);
+        return;
+      }
+      r[DMA_TI]        = cb->info;
+      r[DMA_SOURCE_AD] = cb->src;
+      r[DMA_DEST_AD]   = cb->dst;
+      r[DMA_TXFR_LEN]  = cb->length;
+      r[DMA_STRIDE]    = cb->stride;
+      r[DMA_NEXTCONBK] = cb->next;
+      dmaLoaded[ch] = 1;
+    }
+
+    /* the end of the block: go to the next one */
+    if (r[DMA_TXFR_LEN] < 4) {
+      r[DMA_CONBLK_AD] = r[DMA_NEXTCONBK];
+      dmaLoaded[ch] = 0;
+      continue;
+    }
+
+    /* transfer a word */
+    src = busToVirt(r[DMA_SOURCE_AD]);
+    if (src == 0) {
+      dmaError(r, ch, "bad source", r[DMA_SOURCE_AD]);
+      return;
+    }
+    if (r[DMA_DEST_AD] == PWM_PHYS_FIFO) {
+      if (fifoCount == FIFO_DEPTH) { return; }	/* wait for DREQ */
+      fifo[(fifoHead + fifoCount++) % FIFO_DEPTH] = *src;
+    } else if (r[DMA_DEST_AD] - GPIO_PHYS_BASE < PAGE_SIZE) {
+      writeGpio((r[DMA_DEST_AD] - GPIO_PHYS_BASE) / 4, *src, t);
+    } else if ((dst = busToVirt(r[DMA_DEST_AD])) != 0) {
+      *dst = *src;
+    }	/* other peripherals are ignored */
+    if (r[DMA_TI] & DMA_SRC_INC)  { r[DMA_SOURCE_AD] += 4; }
+    if (r[DMA_TI] & DMA_DEST_INC) { r[DMA_DEST_AD] += 4; }
+    r[DMA_TXFR_LEN] -= 4;
+  }
+}
+
+/**
+ * Bring the model up to time `now`.
+ * \return  Nonzero if the hardware is busy.
+ */
+static int step(int64_t now)
+{
+  uint32_t *pwm = regsAt(PWM_BASE);
+  uint32_t *clk = regsAt(PWMCLK_BASE);
+  uint32_t *dma = regsAt(DMA_BASE);
+  uint32_t ctl, div, srcHz, clkPs, range[2];
+  int dual, ch0, busy = 0;
+  int64_t t = now;	/* when the DMA runs */
+  int c, i;
+
+  if (pwm == 0 || clk == 0 || dma == 0) { return 0; }
+
+  ctl = pwm[PWM_CTL];
+  dual = ((ctl & PWM1_USEFIFO) && (ctl & PWM2_USEFIFO));
+  ch0 = ((ctl & PWM1_USEFIFO) ? 0 : 1);
+  div = (clk[PWMCLK_DIV] >> 12) & 0xfff;
+  srcHz = ((clk[PWMCLK_CTL] & 0xf) == 1 ? 19200000 : 500000000);  /* osc/PLLD */
+  clkPs = (uint32_t)(div * (1000000000000LL / srcHz));
+  range[0] = pwm[PWM_RNG1];
+  range[1] = pwm[PWM_RNG2];
+
+  /* an empty FIFO starts when the DMA fills it */
+  if (fifoCount == 0 && pwmTime < now) { pwmTime = now; }
+
+  for (;;) {
+    int64_t period;
+
+    for (c = 0; c < N_DMA_CH; c++) {
+      runDma(dma, c, t);
+      busy |= ((dma[DMA_CHANNEL_INC * c + DMA_CS] & DMA_ACTIVE) != 0);
+    }
+    period = (int64_t)range[ch0] * clkPs / 1000;
+    if (fifoCount == 0 || period <= 0 ||
+        (ctl & (PWM1_USEFIFO | PWM2_USEFIFO)) == 0 ||
+        (ctl & (PWM1_ENABLE | PWM2_ENABLE)) == 0) {
+      if (pwmTime < now) { pwmTime = now; }	/* idle */
+      break;
+    }
+    busy = 1;
+    if (pwmTime > now) { break; }
+
+    /* the channel(s) take words; the DMA refills the FIFO then */
+    t = pwmTime;
+    for (i = 0; i < (dual ? 2 : 1) && fifoCount > 0; i++) {
+      pwm_sim_sample_t *s;
+      c = (dual ? fifoNextCh : ch0);
+      fifoNextCh = (dual ? 1 - fifoNextCh : 0);
+      s = &samples[nSamples++];
+      s->t = pwmTime;
+      s->word = fifo[fifoHead];
+      s->clkPs = clkPs;
+      s->range = range[c];
+      s->ch = c;
+      s->serial = ((ctl & (c == 0 ? PWM1_SERIAL : PWM2_SERIAL)) != 0);
+      fifoHead = (fifoHead + 1) % FIFO_DEPTH;
+      fifoCount--;
+      words[c]++;
+      if (nSamples == SAMPLE_BUF) { flushSamples(); }
+    }
+    pwmTime += period;
+  }
+  flushSamples();
+
+  pwm[PWM_STA] = (fifoCount == 0 ? PWM_STA_EMPT1 : 0) |
+                 (fifoCount == FIFO_DEPTH ? PWM_STA_FULL1 : 0);
+  return busy;
+}
+
+static void *simThread(void *arg)
+{
+  pthread_mutex_lock(&lock);
+  while (running) {
+    int64_t t = nowNs();
+    int busy = step(t);
+    struct timespec ts;
+    t += 1000LL * (busy ? SIM_TICK_US : SIM_IDLE_US);
+    ts.tv_sec  = t / 1000000000LL;
+    ts.tv_nsec = t % 1000000000LL;
+    pthread_cond_timedwait(&wakeup, &lock, &ts);
+  }
+  pthread_mutex_unlock(&lock);
+  return arg;
+}
+
+/** Start the model thread (with the lock held) */
+static int startThread(void)
+{
+  pthread_condattr_t attr;
+  pthread_t th;
+  const char *path;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&wakeup, &attr);
+  pthread_condattr_destroy(&attr);
+
+  path = getenv("SERIALLED_SIM_CAPTURE");
+  if (path != 0 && capture == 0) {
+    capture = fopen(path, "wb");
+    if (capture == 0) { perror(path); }
+  }
+
+  pwmTime = nowNs();
+  running = 1;
+  if (pthread_create(&th, 0, simThread, 0) != 0) {
+    running = 0;
+    fprintf(stderr, "pwmsim: cannot create a thread\n");
+    return -1;
+  }
+  pthread_detach(th);
+  return 0;
+}
+
+/*
+ * The backend
+ */
+
+static volatile uint32_t *simMapRegs(uint32_t base)
+{
+  void *p = 0;
+
+  pthread_mutex_lock(&lock);
+  if ((p = regsAt(base)) == 0 && nPages < MAX_PAGES &&
+      posix_memalign(&p, PAGE_SIZE, PAGE_SIZE) == 0) {
+    memset(p, 0, PAGE_SIZE);
+    pages[nPages].base = base;
+    pages[nPages].p = p;
+    nPages++;
+  }
+  if (p != 0 && !running && startThread() != 0) {
+    p = 0;
+  }
+  pthread_mutex_unlock(&lock);
+  return p;
+}
+
+static void *simAllocDma(unsigned int size, unsigned int *busAddr,
+                         void **mem)
+{
+  void *p = 0;
+  int i;
+
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < MAX_REGIONS; i++) {
+    if (regions[i].virt == 0) { break; }
+  }
+  if (i < MAX_REGIONS && posix_memalign(&p, PAGE_SIZE, size) == 0) {
+    memset(p, 0, size);
+    regions[i].virt = p;
+    regions[i].bus  = nextBus;
+    regions[i].size = size;
+    *busAddr = nextBus;
+    nextBus += (size + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+  } else {
+    fprintf(stderr, "pwmsim: cannot allocate memory for DMA\n");
+    p = 0;
+  }
+  pthread_mutex_unlock(&lock);
+  *mem = p;
+  return p;
+}
+
+static void simFreeDma(void *mem, void *virt, unsigned int size)
+{
+  int i;
+
+  pthread_mutex_lock(&lock);
+  for (i = 0; i < MAX_REGIONS; i++) {
+    if (regions[i].virt == virt) {
+      regions[i].virt = 0;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  free(virt);
+  mem = mem;	/* suppress 'unused' warnings */
+  size = size;
+}
+
+static void simLockDma(void)
+{
+  pthread_mutex_lock(&lock);
+}
+
+static void simUnlockDma(void)
+{
+  pthread_cond_signal(&wakeup);	/* start at once if idle */
+  pthread_mutex_unlock(&lock);
+}
+
+const pwm_backend_t pwmSimBackend = {
+  "sim", simMapRegs, simAllocDma, simFreeDma, simLockDma, simUnlockDma
+};
+
+/*
+ * The output
+ */
+
+/**
+ * Set a function receiving the words shifted out of the PWM.
+ * It is called on the model thread.
+ * \param sink  The function (0 for none).
+ * \param arg   Passed to `sink`.
+ */
+void pwmSimSetSink(pwm_sim_sink_t sink, void *arg)
+{
+  pthread_mutex_lock(&lock);
+  outSink = sink;
+  outArg = arg;
+  pthread_mutex_unlock(&lock);
+}
+
+/**
+ * Write the words shifted out of the PWM into a file
+ * (pwm_sim_sample_t records; see also SERIALLED_SIM_CAPTURE).
+ * \param path  The file (0 to stop).
+ * \return 0 for success; -1 for failure.
+ */
+int pwmSimCapture(const char *path)
+{
+  int result = 0;
+
+  pthread_mutex_lock(&lock);
+  if (capture != 0) {
+    fclose(capture);
+    capture = 0;
+  }
+  if (path != 0) {
+    capture = fopen(path, "wb");
+    if (capture == 0) {
+      perror(path);
+      result = -1;
+    }
+  }
+  pthread_mutex_unlock(&lock);
+  return result;
+}
+
+/**
+ * The number of words shifted out by PWM channel `ch` (0 or 1).
+ */
+uint64_t pwmSimWords(int ch)
+{
+  uint64_t n;
+  pthread_mutex_lock(&lock);
+  n = words[ch & 1];
+  pthread_mutex_unlock(&lock);
+  return n;
+}
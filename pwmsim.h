@@ -0,0 +1,40 @@
+/*
+ * pwmsim.h:
+ * A software model of the PWM and DMA (the backend "sim").
+ *
+ * Select it by pwmSetBackend("sim") or SERIALLED_BACKEND=sim;
+ * then the whole library runs on any Linux box without /dev/mem.
+ */
+#ifndef PWMSIM_H
+#define PWMSIM_H
+
+#include <stdint.h>
+
+/*
+ * A word shifted out by a PWM channel.
+ * Mark:space mode: the output is high for `word` clocks of `range`.
+ * Serializer mode: the top `range` bits of `word` are shifted out
+ *                  one per clock, MSB first.
+ * A write of the DMA to GPSET0/GPCLR0 is reported with ch PWM_SIM_GPIO:
+ * `word` is then the level of GPIO 0..31 from `t` (range and clkPs 0).
+ * A capture file (see pwmSimCapture()) is a sequence of these records.
+ */
+typedef struct {
+  uint64_t t;		/* start time in ns (CLOCK_MONOTONIC) */
+  uint32_t word;	/* the word taken from the FIFO */
+  uint32_t clkPs;	/* period of the PWM clock in ps */
+  uint16_t range;	/* the range of the channel */
+  uint8_t ch;		/* PWM channel: 0 or 1 */
+  uint8_t serial;	/* 1: serializer mode, 0: mark:space mode */
+} pwm_sim_sample_t;
+
+#define PWM_SIM_GPIO	2	/* `ch` of a change of the GPIO */
+
+/* Called by the model with `n` samples shifted out (keep it short) */
+typedef void (*pwm_sim_sink_t)(const pwm_sim_sample_t *s, int n, void *arg);
+
+void pwmSimSetSink(pwm_sim_sink_t sink, void *arg);
+int pwmSimCapture(const char *path);
+uint64_t pwmSimWords(int ch);
+
+#endif /* PWMSIM_H */
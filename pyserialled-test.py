@@ -0,0 +1,48 @@
+#!/usr/bin/python3
+# coding: utf-8
+
+# Cで書いた拡張モジュールでLEDテープを光らせるよ
+# A testing script of pyserialled.c: a frame made by NumPy is sent
+# with one call, without any work per pixel in Python.
+# $ make python
+# $ sudo python3 pyserialled-test.py
+
+import time
+import pyserialled
+
+LED_GPIO = 18
+N_LED = 12
+
+strip = pyserialled.Strip(LED_GPIO, N_LED)
+
+try:
+  import numpy
+except ImportError:
+  numpy = None
+
+if numpy is not None:
+  # the colors of the strip as an array of (N_LED, 3) bytes (not a copy)
+  pixels = numpy.asarray(strip)
+  hue = numpy.arange(N_LED) * 3 // N_LED
+  for i in range(30):
+    pixels[:] = 0
+    pixels[numpy.arange(N_LED), (hue + i) % 3] = 255
+    strip.send()
+    time.sleep(1 / 30)
+else:
+  # the same with a memoryview
+  pixels = memoryview(strip).cast("B")
+  for i in range(30):
+    frame = bytearray(N_LED * 3)
+    for led in range(N_LED):
+      frame[led * 3 + (led + i) % 3] = 255
+    pixels[:] = frame
+    strip.send()
+    time.sleep(1 / 30)
+
+# bytes (or any buffer) can be passed to send()
+strip.send(bytes([255, 255, 255] * N_LED))
+strip.wait_sent()
+time.sleep(0.5)
+
+strip.close()
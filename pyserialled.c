@@ -0,0 +1,501 @@
+/*
+ * pyserialled.c:
+ * A CPython extension module of this library (import pyserialled).
+ *
+ * A Strip owns the R,G,B (R,G,B,W for RGBW chips) bytes of its LEDs
+ * and exports them by the buffer protocol as a writable array of
+ * (LEDs, bytes per LED) unsigned bytes, so that memoryview(strip) or
+ * numpy.asarray(strip) writes the colors in place:
+ *
+ *   strip = pyserialled.Strip(18, 300)
+ *   pixels = numpy.asarray(strip)	# shape (300, 3), dtype uint8
+ *   pixels[:] = frame
+ *   strip.send()
+ *
+ * send() hands the whole array to ledStripSetPixels() (only the changed
+ * LEDs are re-encoded) and calls ledStripSend(), both without the GIL,
+ * so other Python threads run while a frame is encoded and while
+ * waiting for the DMA.  A lock per strip keeps the other methods off the
+ * strip meanwhile.
+ *
+ * $ make python
+ * $ sudo python3 pyserialled-test.py
+ *
+ * Copyright (c) 2017 Yoshiaki Takata
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+#include <string.h>	/* memcpy, memset */
+
+#include "serialled.h"
+
+typedef struct {
+  PyObject_HEAD
+  led_strip_t *strip;		/* 0 after close() */
+  unsigned char *pixels;	/* R,G,B(,W) of the LEDs */
+  Py_ssize_t shape[2];		/* LEDs, bytes per LED */
+  Py_ssize_t strides[2];
+  Py_ssize_t exports;		/* the buffers exported and not released */
+  PyThread_type_lock lock;	/* held while the strip is in use */
+} StripObject;
+
+/** Take the lock of a strip, releasing the GIL if it must wait */
+static void lockStrip(StripObject *self)
+{
+  if (!PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+    Py_BEGIN_ALLOW_THREADS
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    Py_END_ALLOW_THREADS
+  }
+}
+
+static void unlockStrip(StripObject *self)
+{
+  PyThread_release_lock(self->lock);
+}
+
+/** Raise ValueError if the strip is closed */
+static int checkOpen(StripObject *self)
+{
+  if (self->strip == 0) {
+    PyErr_SetString(PyExc_ValueError, "the strip is closed");
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Strip(gpio, n, mode=MODE_MS, chip=CHIP_WS2812B, gpio2=-1, n2=0)
+ * With gpio2, LEDs n..n+n2-1 are on the second strip driven by the
+ * other PWM channel (see ledStripCreateDualChip()).
+ */
+static int Strip_init(StripObject *self, PyObject *args, PyObject *kwds)
+{
+  static char *kwlist[] = { "gpio", "n", "mode", "chip", "gpio2", "n2", 0 };
+  int gpio, n, mode = LED_MODE_MS, chip = LED_CHIP_WS2812B;
+  int gpio2 = -1, n2 = 0, nb;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "ii|iiii", kwlist,
+                                   &gpio, &n, &mode, &chip, &gpio2, &n2)) {
+    return -1;
+  }
+  if (self->strip != 0) {
+    PyErr_SetString(PyExc_RuntimeError, "the strip is already set up");
+    return -1;
+  }
+  if (self->exports > 0) {
+    /* the pixels are replaced below */
+    PyErr_SetString(PyExc_BufferError,
+                    "the pixels are exported (e.g. by a memoryview)");
+    return -1;
+  }
+  if (gpio2 < 0) {
+    n2 = 0;
+  }
+  if (n < 0 || n2 < 0) {
+    PyErr_SetString(PyExc_ValueError, "negative number of LEDs");
+    return -1;
+  }
+  if (self->lock == 0) {
+    self->lock = PyThread_allocate_lock();
+    if (self->lock == 0) {
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
+
+  Py_BEGIN_ALLOW_THREADS
+  self->strip = (gpio2 < 0 ? ledStripCreateChip(gpio, n, mode, chip) :
+                 ledStripCreateDualChip(gpio, n, gpio2, n2, mode, chip));
+  Py_END_ALLOW_THREADS
+  if (self->strip == 0) {
+    PyErr_SetString(PyExc_OSError, "cannot setup serial led");
+    return -1;
+  }
+
+  nb = ledStripBytesPerLed(self->strip);
+  PyMem_Free(self->pixels);
+  self->pixels = PyMem_Calloc((size_t)(n + n2) * nb + 1, 1);
+  if (self->pixels == 0) {
+    ledStripDestroy(self->strip);
+    self->strip = 0;
+    PyErr_NoMemory();
+    return -1;
+  }
+  self->shape[0] = n + n2;
+  self->shape[1] = nb;
+  self->strides[0] = nb;
+  self->strides[1] = 1;
+  return 0;
+}
+
+/** Turn off the LEDs and release the strip (the pixels stay) */
+static void closeStrip(StripObject *self)
+{
+  led_strip_t *strip = self->strip;
+
+  self->strip = 0;
+  if (strip != 0) {
+    ledStripClearAll(strip);
+    ledStripWaitSent(strip, -1);
+    ledStripDestroy(strip);
+  }
+}
+
+static void Strip_dealloc(StripObject *self)
+{
+  if (self->strip != 0) {
+    Py_BEGIN_ALLOW_THREADS
+    closeStrip(self);
+    Py_END_ALLOW_THREADS
+  }
+  if (self->lock != 0) {
+    PyThread_free_lock(self->lock);
+  }
+  PyMem_Free(self->pixels);
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/*
+ * send([pixels]): send the colors of the array to the strip.
+ * pixels (any object of the buffer protocol, e.g. bytes or a NumPy
+ * array of uint8) is copied into the array first; a shorter one sets
+ * the first LEDs only.
+ */
+static PyObject *Strip_send(StripObject *self, PyObject *args)
+{
+  PyObject *obj = 0;
+  Py_buffer src;
+  Py_ssize_t size = self->shape[0] * self->shape[1];
+  int result;
+
+  if (!PyArg_ParseTuple(args, "|O", &obj)) { return 0; }
+  if (checkOpen(self) == -1) { return 0; }
+  if (obj != 0 && obj != Py_None) {
+    if (PyObject_GetBuffer(obj, &src, PyBUF_C_CONTIGUOUS) == -1) {
+      return 0;
+    }
+    if (src.len > size) {
+      PyBuffer_Release(&src);
+      PyErr_SetString(PyExc_ValueError, "more pixels than the LEDs");
+      return 0;
+    }
+  } else {
+    obj = 0;
+  }
+
+  lockStrip(self);
+  Py_BEGIN_ALLOW_THREADS
+  if (obj != 0) {
+    memcpy(self->pixels, src.buf, src.len);
+  }
+  if (self->strip == 0) {
+    result = -2;	/* closed by another thread */
+  } else {
+    ledStripSetPixels(self->strip, 0, (int)self->shape[0], self->pixels,
+                      LED_ORDER_RGB);
+    result = ledStripSend(self->strip);
+  }
+  Py_END_ALLOW_THREADS
+  unlockStrip(self);
+
+  if (obj != 0) {
+    PyBuffer_Release(&src);
+  }
+  if (result == -2) {
+    checkOpen(self);
+    return 0;
+  }
+  if (result == -1) {
+    PyErr_SetString(PyExc_RuntimeError,
+                    "the frame does not fit the DMA buffer");
+    return 0;
+  }
+  Py_RETURN_NONE;
+}
+
+/*
+ * wait_sent(timeout_ms=-1): wait until the frames have been sent.
+ * Returns False on timeout.
+ */
+static PyObject *Strip_wait_sent(StripObject *self, PyObject *args)
+{
+  int timeoutMs = -1, result;
+
+  if (!PyArg_ParseTuple(args, "|i", &timeoutMs)) { return 0; }
+  if (checkOpen(self) == -1) { return 0; }
+  lockStrip(self);
+  Py_BEGIN_ALLOW_THREADS
+  result = ledStripWaitSent(self->strip, timeoutMs);
+  Py_END_ALLOW_THREADS
+  unlockStrip(self);
+  return PyBool_FromLong(result == 0);
+}
+
+/* clear(): turn off all the LEDs (the array is cleared, too) */
+static PyObject *Strip_clear(StripObject *self, PyObject *unused)
+{
+  (void)unused;
+  if (checkOpen(self) == -1) { return 0; }
+  lockStrip(self);
+  Py_BEGIN_ALLOW_THREADS
+  memset(self->pixels, 0, self->shape[0] * self->shape[1]);
+  ledStripClearAll(self->strip);
+  Py_END_ALLOW_THREADS
+  unlockStrip(self);
+  Py_RETURN_NONE;
+}
+
+/* close(): turn off the LEDs and release the hardware */
+static PyObject *Strip_close(StripObject *self, PyObject *unused)
+{
+  (void)unused;
+  lockStrip(self);
+  Py_BEGIN_ALLOW_THREADS
+  closeStrip(self);
+  Py_END_ALLOW_THREADS
+  unlockStrip(self);
+  Py_RETURN_NONE;
+}
+
+static PyObject *Strip_enter(StripObject *self, PyObject *unused)
+{
+  (void)unused;
+  Py_INCREF(self);
+  return (PyObject *)self;
+}
+
+static PyObject *Strip_exit(StripObject *self, PyObject *args)
+{
+  (void)args;
+  return Strip_close(self, 0);
+}
+
+/** The setters of an int: call f(strip, x) and raise ValueError on -1 */
+static PyObject *setInt(StripObject *self, PyObject *args,
+                        int (*f)(led_strip_t *, int))
+{
+  int x, result;
+
+  if (!PyArg_ParseTuple(args, "i", &x)) { return 0; }
+  if (checkOpen(self) == -1) { return 0; }
+  lockStrip(self);
+  result = f(self->strip, x);
+  unlockStrip(self);
+  if (result == -1) {
+    PyErr_SetString(PyExc_ValueError, "invalid value");
+    return 0;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *Strip_set_gamma(StripObject *self, PyObject *args)
+{
+  return setInt(self, args, ledStripSetGamma);
+}
+
+static PyObject *Strip_set_brightness(StripObject *self, PyObject *args)
+{
+  return setInt(self, args, ledStripSetBrightness);
+}
+
+static PyObject *Strip_set_dither(StripObject *self, PyObject *args)
+{
+  return setInt(self, args, ledStripSetDither);
+}
+
+static PyObject *Strip_set_refresh(StripObject *self, PyObject *args)
+{
+  return setInt(self, args, ledStripSetRefresh);
+}
+
+static PyObject *Strip_set_threads(StripObject *self, PyObject *args)
+{
+  return setInt(self, args, ledStripSetThreads);
+}
+
+/* set_power_limit(channel_ma, idle_ma, budget_ma) */
+static PyObject *Strip_set_power_limit(StripObject *self, PyObject *args)
+{
+  int channelMa, idleMa, budgetMa, result;
+
+  if (!PyArg_ParseTuple(args, "iii", &channelMa, &idleMa, &budgetMa)) {
+    return 0;
+  }
+  if (checkOpen(self) == -1) { return 0; }
+  lockStrip(self);
+  result = ledStripSetPowerLimit(self->strip, channelMa, idleMa, budgetMa);
+  unlockStrip(self);
+  if (result == -1) {
+    PyErr_SetString(PyExc_ValueError, "invalid value");
+    return 0;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyObject *Strip_get_bytes_per_led(StripObject *self, void *closure)
+{
+  (void)closure;
+  return PyLong_FromSsize_t(self->shape[1]);
+}
+
+static PyObject *Strip_get_frame_us(StripObject *self, void *closure)
+{
+  (void)closure;
+  if (checkOpen(self) == -1) { return 0; }
+  return PyLong_FromLong(ledStripFrameUs(self->strip));
+}
+
+static PyObject *Strip_get_closed(StripObject *self, void *closure)
+{
+  (void)closure;
+  return PyBool_FromLong(self->strip == 0);
+}
+
+static Py_ssize_t Strip_length(StripObject *self)
+{
+  return self->shape[0];
+}
+
+/*
+ * The buffer protocol: a C-contiguous array of (LEDs, bytes per LED)
+ * unsigned bytes, or plain bytes for consumers not asking for a shape.
+ */
+static int Strip_getbuffer(StripObject *self, Py_buffer *view, int flags)
+{
+  if (self->pixels == 0) {
+    PyErr_SetString(PyExc_BufferError, "the strip is not set up");
+    view->obj = 0;
+    return -1;
+  }
+  if (PyBuffer_FillInfo(view, (PyObject *)self, self->pixels,
+                        self->shape[0] * self->shape[1], 0, flags) == -1) {
+    return -1;
+  }
+  if ((flags & PyBUF_ND) == PyBUF_ND) {
+    view->ndim = 2;
+    view->shape = self->shape;
+  }
+  if ((flags & PyBUF_STRIDES) == PyBUF_STRIDES) {
+    view->strides = self->strides;
+  }
+  self->exports++;
+  return 0;
+}
+
+static void Strip_releasebuffer(StripObject *self, Py_buffer *view)
+{
+  (void)view;
+  self->exports--;
+}
+
+static PyBufferProcs Strip_as_buffer = {
+  (getbufferproc)Strip_getbuffer,
+  (releasebufferproc)Strip_releasebuffer,
+};
+
+static PySequenceMethods Strip_as_sequence = {
+  .sq_length = (lenfunc)Strip_length,
+};
+
+static PyMethodDef Strip_methods[] = {
+  { "send", (PyCFunction)Strip_send, METH_VARARGS,
+    "send([pixels]): send the colors (R,G,B bytes per LED) to the strip" },
+  { "wait_sent", (PyCFunction)Strip_wait_sent, METH_VARARGS,
+    "wait_sent(timeout_ms=-1): wait until the frames have been sent" },
+  { "clear", (PyCFunction)Strip_clear, METH_NOARGS,
+    "clear(): turn off all the LEDs" },
+  { "close", (PyCFunction)Strip_close, METH_NOARGS,
+    "close(): turn off the LEDs and release the hardware" },
+  { "set_gamma", (PyCFunction)Strip_set_gamma, METH_VARARGS,
+    "set_gamma(gamma100): gamma times 100 (e.g. 220)" },
+  { "set_brightness", (PyCFunction)Strip_set_brightness, METH_VARARGS,
+    "set_brightness(brightness): 0 to 255" },
+  { "set_dither", (PyCFunction)Strip_set_dither, METH_VARARGS,
+    "set_dither(on): temporal dithering" },
+  { "set_refresh", (PyCFunction)Strip_set_refresh, METH_VARARGS,
+    "set_refresh(interval_ms): resend an unchanged frame (see ledSetRefresh())" },
+  { "set_threads", (PyCFunction)Strip_set_threads, METH_VARARGS,
+    "set_threads(n): threads encoding a long frame (0: the CPUs)" },
+  { "set_power_limit", (PyCFunction)Strip_set_power_limit, METH_VARARGS,
+    "set_power_limit(channel_ma, idle_ma, budget_ma)" },
+  { "__enter__", (PyCFunction)Strip_enter, METH_NOARGS, 0 },
+  { "__exit__", (PyCFunction)Strip_exit, METH_VARARGS, 0 },
+  { 0 }
+};
+
+static PyGetSetDef Strip_getset[] = {
+  { "bytes_per_led", (getter)Strip_get_bytes_per_led, 0,
+    "3, or 4 for RGBW chips", 0 },
+  { "frame_us", (getter)Strip_get_frame_us, 0,
+    "the time to send a frame in microseconds", 0 },
+  { "closed", (getter)Strip_get_closed, 0, "True after close()", 0 },
+  { 0 }
+};
+
+static PyTypeObject StripType = {
+  PyVarObject_HEAD_INIT(0, 0)
+  .tp_name = "pyserialled.Strip",
+  .tp_doc = "Strip(gpio, n, mode=MODE_MS, chip=CHIP_WS2812B, gpio2=-1, n2=0)\n"
+            "A LED strip whose colors are a writable buffer of "
+            "(n, bytes_per_led) bytes.",
+  .tp_basicsize = sizeof(StripObject),
+  .tp_flags = Py_TPFLAGS_DEFAULT,
+  .tp_new = PyType_GenericNew,
+  .tp_init = (initproc)Strip_init,
+  .tp_dealloc = (destructor)Strip_dealloc,
+  .tp_methods = Strip_methods,
+  .tp_getset = Strip_getset,
+  .tp_as_buffer = &Strip_as_buffer,
+  .tp_as_sequence = &Strip_as_sequence,
+};
+
+static struct PyModuleDef pyserialledModule = {
+  PyModuleDef_HEAD_INIT,
+  .m_name = "pyserialled",
+  .m_doc = "Serial LED strips (WS2812B etc.) on the PWM of Raspberry Pi",
+  .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_pyserialled(void)
+{
+  PyObject *m;
+
+  if (PyType_Ready(&StripType) < 0) { return 0; }
+  m = PyModule_Create(&pyserialledModule);
+  if (m == 0) { return 0; }
+
+  Py_INCREF(&StripType);
+  if (PyModule_AddObject(m, "Strip", (PyObject *)&StripType) < 0) {
+    Py_DECREF(&StripType);
+    Py_DECREF(m);
+    return 0;
+  }
+  PyModule_AddIntConstant(m, "MODE_MS", LED_MODE_MS);
+  PyModule_AddIntConstant(m, "MODE_SERIAL", LED_MODE_SERIAL);
+  PyModule_AddIntConstant(m, "CHIP_WS2812B", LED_CHIP_WS2812B);
+  PyModule_AddIntConstant(m, "CHIP_SK6812_RGBW", LED_CHIP_SK6812_RGBW);
+  PyModule_AddIntConstant(m, "CHIP_WS2811", LED_CHIP_WS2811);
+  PyModule_AddIntConstant(m, "CHIP_APA106", LED_CHIP_APA106);
+  return m;
+}
@@ -9,6 +9,7 @@
 #include <math.h>
 
 #include "serialled.h"
+#include "ledsched.h"
 
 /* GPIO番号 */
 #define LED_GPIO  18
@@ -19,7 +20,10 @@
 /* frame per second */
 #define FPS  60
 
-/* 時刻 t, LED i の色を設定します Set the color of LED i at time t. */
+/* LEDごとの色 (HSB) The colors of the LEDs in HSB. */
+int hue[N_LED], sat[N_LED], bri[N_LED];
+
+/* 時刻 t, LED i の色を決めます Compute the color of LED i at time t. */
 void setColor(int t, int i)
 {
   int t0 = (t + 540 + 90) % (360 * 8) - 3 * i;
@@ -34,12 +38,14 @@ void setColor(int t, int i)
   int h = i * 360 / N_LED;
   h = (h + 360 - t % 360) % 360;
 
-  /* 色を設定 (まだ送信しない) Set the color (but not transmit yet). */
-  ledSetColorHSB(i, h, s, b);
+  hue[i] = h;
+  sat[i] = s;
+  bri[i] = b;
 }
 
 int main()
 {
+  led_sched_t *sched;
   int t;
 
   /* 実行優先度を上げるよ Increase the process priority. */
@@ -59,19 +65,28 @@ int main()
   /* wait 5 sec */
   usleep(1000 * 1000 * 5);
 
+  /* 一定の間隔でフレームを送るよ Send frames at a fixed rate. */
+  sched = ledSchedCreate(0, FPS, 0);
+
   /* 6時間点灯するよ Glitter for 6 hours. */
   for (t = 0; t < 6 * 3600 * FPS; t++) {
     int led;
     for (led = 0; led < N_LED; led++) {
-      /* 色を設定 (まだ送信しない) Set the color (but not transmit yet). */
       setColor(t, led);
     }
+    /* 色をまとめて設定 (まだ送信しない)
+     * Set the colors at once (but not transmit yet). */
+    ledSetColorsHSB(0, N_LED, hue, sat, bri);
+    /* 次のフレームの時刻まで待ってください Wait until the next frame. */
+    ledSchedWait(sched);
+
     /* 送信! Transmit the color data! */
     ledSend();
-
-    /* 次のフレームまで待ってください Wait until the next frame. */
-    usleep(1000 * 1000 / FPS);
   }
+#if DEBUG
+  fprintf(stderr, "missed %lu frames\n", ledSchedMissed(sched));
+#endif
+  ledSchedDestroy(sched);
 
   /* 全部消灯します Turn off all LEDs. */
   ledClearAll();
@@ -23,18 +23,28 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+#include <stdlib.h>	/* calloc */
+#include <string.h>	/* memset, strcmp */
+#include <time.h>	/* clock_gettime */
+#include <math.h>	/* pow */
+
 #include "serialled.h"
 #include "pwmfifo.h"
+#include "ledencode.h"
+#include "ledpool.h"
 
 /*
  * PWM clock divisor:
  * in pwmfifo.c, we choose PLL_D (500MHz) as the clock source.
  */
 #if NOT_USE_PLL
+# define PWM_SOURCE_KHZ	19200	/* oscillator */
 # define PWM_CLOCK_DIV	2	/* 19.2MHz / 2 == 9.6MHz */
 #else
+# define PWM_SOURCE_KHZ	500000	/* PLL_D */
 # define PWM_CLOCK_DIV	25	/* 500MHz / 25 == 20MHz */
 #endif
+#define PWM_CLOCK_KHZ	(PWM_SOURCE_KHZ / PWM_CLOCK_DIV)
 
 /*
  * PWM bit representation:
@@ -45,174 +55,1740 @@
  *    <------------>
  *     T_CYCLE
  *
+ * The timings differ among the chips (see `chips` below).
  * For WS2812B-based LED strips (e.g. <http://ssci.to/1400>):
  *   T_CYCLE = 1.25us +-600ns
  *   T0H     = 0.4 us +-150ns
  *   T1H     = 0.8 us +-150ns
  *   RESET code = Low >=50us
+ * In the mark:space mode, the PWM clock is the same (PWM_CLOCK_DIV)
+ * for all the chips, and the range of a channel is T_CYCLE.
  */
-#if NOT_USE_PLL
-# define T_CYCLE	12	/* 1.25us * 9.6MHz */
-# define T0H		4	/* 0.4 us */
-# define T1H		8	/* 0.8 us */
-#else
-# define T_CYCLE	25	/* 1.25us * 20MHz */
-# define T0H		8	/* 0.4 us */
-# define T1H		16	/* 0.8 us */
-#endif
-# define RST_BITS	40	/* RESET (50us) == 40 * 1.25us */
 
 /*
- * Transmission order of R,G,B:
- * For WS2812B, the order is G,R,B.
+ * Serializer mode (LED_MODE_SERIAL):
+ * the PWM shifts out 32-bit words and each bit above is represented
+ * by `subbits` bits of T_CYCLE / subbits.  For WS2812B, 3 bits of
+ * 1.25us / 3 == 0.417us (0: 100, 1: 110; see ledencode.h),
+ * so T0H == 0.417us and T1H == 0.833us; the PWM clock is 2.4MHz.
+ * The clock is shared by the two PWM channels, so strips of chips
+ * with different clocks cannot be driven in this mode at once.
  */
-#define COLOR_ORDER	ORDER_GRB
-#define ORDER_GRB	0
-#define ORDER_RGB	1
+#define SERIAL_RANGE	32	/* all the 32 bits of a word are used */
+
+/* A type of LED chip (LED_CHIP_*) */
+typedef struct {
+  const char *name;		/* for ledChipByName() */
+  int cycleNs, t0hNs, t1hNs;	/* T_CYCLE, T0H, T1H */
+  int resetNs;			/* the minimum RESET code */
+  int order;			/* the default order of R,G,B */
+  int bytesPerLed;		/* 3 (RGB) or 4 (RGBW; W is the last) */
+  int subbits;			/* the serializer mode */
+  uint32_t code0, code1;
+} led_chip_t;
+
+static const led_chip_t chips[] = {
+  /* LED_CHIP_WS2812B: 1.25us, T0H 0.4us, T1H 0.8us, RESET >= 50us */
+  { "ws2812b", 1250, 400, 800, 50000, LED_ORDER_GRB, 3, 3, 0x4, 0x6 },
+  /*
+   * LED_CHIP_SK6812_RGBW: 1.25us, T0H 0.3us, T1H 0.6us, RESET >= 80us.
+   * In the serializer mode: 4 bits of 0.3125us (0: 1000, 1: 1100)
+   */
+  { "sk6812", 1250, 300, 600, 80000, LED_ORDER_GRB, 4, 4, 0x8, 0xc },
+  /*
+   * LED_CHIP_WS2811 (low speed mode):
+   * 2.5us, T0H 0.5us, T1H 1.2us, RESET >= 50us.
+   * In the serializer mode: 4 bits of 0.625us (0: 1000, 1: 1100)
+   */
+  { "ws2811", 2500, 500, 1200, 50000, LED_ORDER_RGB, 3, 4, 0x8, 0xc },
+  /*
+   * LED_CHIP_APA106: 1.71us, T0H 0.35us, T1H 1.36us, RESET >= 50us.
+   * In the serializer mode: 4 bits of 0.4275us (0: 1000, 1: 1110)
+   */
+  { "apa106", 1710, 350, 1360, 50000, LED_ORDER_RGB, 3, 4, 0x8, 0xe },
+};
+
+#define N_CHIPS  ((int)(sizeof(chips) / sizeof(chips[0])))
+
+/* ns -> PWM clocks of the mark:space mode */
+#define NS_TO_CLOCKS(ns)  (((ns) * PWM_CLOCK_KHZ + 500000) / 1000000)
 
 /* The number of bits for each of R,G,B */
 #define RGB_BITS  8
 #define RGB_MAX   ((1 << RGB_BITS) - 1)
 
+/*
+ * The number of DMA buffers whose contents are remembered
+ * (at least N_DMA_BUFS of pwmfifo.c)
+ */
+#define N_ENC_BUFS  4
+
+/*
+ * Color correction (see correctColors()):
+ * each 8-bit value goes through a lookup table of gamma and brightness
+ * into a value of 0..CORR_MAX (8.8 fixed point), which is rounded or
+ * dithered into 8 bits while encoding, CORR_CHUNK LEDs at a time
+ * (a multiple of `ledAlign` of any chip).
+ */
+#define CORR_MAX    (RGB_MAX << 8)
+#define CORR_CHUNK  64
+
+/* the scale of the power limiter (see limitPower()) that keeps colors */
+#define POWER_ONE   0x10000
+
+/*
+ * A frame is encoded in shards of at least SHARD_LEDS LEDs on the
+ * threads of a pool (see encodeSharded()), so that the frames of
+ * shorter strips are encoded by the caller alone.
+ */
+#define SHARD_LEDS  1024
+
+
+/* A LED strip (or two strips driven by the two PWM channels) */
+struct led_strip {
+  /* The number of LEDs (in the both strips) */
+  int nLed;
+
+  /*
+   * The number of strips (1, or 2 for ledStripCreateDual()).
+   * LED 0..chLed[0]-1 are on the first strip and the rest on the second.
+   */
+  int nCh;
+  int chLed[2];
+  int chOrder[2];
+
+  /*
+   * Parallel strips on the GPIO (see ledStripCreateParallel()):
+   * nPar strips of parLen LEDs (nPar is 0 for the PWM), and
+   * LED s * parLen + i is LED i of the strip on the pin parPins[s].
+   */
+  int nPar, parLen;
+  uint32_t parPins[LED_PAR_MAX];
+
+  /* LED_MODE_MS or LED_MODE_SERIAL */
+  int mode;
+
+  /* The type of the LEDs, and the parameters derived from it */
+  const led_chip_t *chip;
+  int bytesPerLed;
+  int rstBits;		/* the RESET code in bits (T_CYCLE each) */
+
+  /*
+   * In the serializer mode, the words of `ledAlign` LEDs do not share
+   * a word with other LEDs (e.g. 4 * 24 * 3 bits == 9 words for WS2812B),
+   * so that a part of a frame can be encoded again.
+   */
+  int ledAlign;
+
+  /* Non-zero while streaming (see ledStripStreamStart()) */
+  int streaming;
+
+  /*
+   * The color of each LED (nLed elements), packed in the transmission
+   * order (e.g. 0xGGRRBB, or 0xGGRRBBWW for RGBW)
+   */
+  unsigned int *color;
+
+  /*
+   * The color of each LED in 16 bits per channel (bytesPerLed * nLed
+   * elements in the transmission order), allocated by ledStripSetColor16();
+   * then the colors are encoded from this instead of `color`.
+   */
+  uint16_t *color16;
+
+  /* Color correction (see ledStripSetGamma() etc.) */
+  int correct;			/* non-zero if any of the below is used */
+  int gamma100;			/* gamma * 100 */
+  int brightness;		/* 0..RGB_MAX */
+  uint16_t corrLut[RGB_MAX + 2];	/* 8-bit value -> 0..CORR_MAX */
+  uint8_t *ditherErr;		/* the error carried to the next frame */
+
+  /* Power limiter (see ledStripSetPowerLimit()) */
+  int channelMa;		/* current of a channel at 255 (mA) */
+  int idleMa;			/* current of an LED at black (mA) */
+  int budgetMa;			/* 0: no limit */
+  unsigned long long powerSum;	/* sum of corrLut[] of all channels */
+  unsigned int powerScale;	/* POWER_ONE: not limited */
+
+  /* LEDs changed since the last ledStripSend(): dirtyLo..dirtyHi-1 */
+  int dirtyLo, dirtyHi;
+
+  /*
+   * DMA buffers holding encoded frames, and their LEDs out of date
+   * (lo..hi-1): only those LEDs are encoded again into the buffer.
+   */
+  struct {
+    uint32_t *buf;
+    int lo, hi;
+  } enc[N_ENC_BUFS];
+  int encNext;		/* the entry to be replaced next */
+
+  /* Resending an unchanged frame (see ledStripSetRefresh()) */
+  int refreshMs;
+  long long sentAt;	/* when the last frame was sent (ms; -1: never) */
 
-/* The number of LEDs in the strip */
-static int nLed;
+  /* Lookup tables for encoding the colors */
+  led_encoder_t encoder;
 
-/* A buffer for keeping the color of each LED */
-static unsigned int ledColor[MAX_N_LED];
+  /* Encoding on several cores (see ledStripSetThreads()) */
+  int nThreads;		/* 0: as many as the CPUs */
+  led_pool_t *pool;	/* created when a frame is long enough */
+
+  /* DMA channel and buffers */
+  pwm_dma_t *dma;
+};
+
+/* The strip used by ledSetup(), ledSend(), etc. */
+static led_strip_t *defaultStrip;
+
+/* The mode and the chip for ledSetup() */
+static int ledMode = LED_MODE_MS;
+static int ledChip = LED_CHIP_WS2812B;
 
 
 /**
- * Setting up the hardware:
- * call this function at the beginning.
+ * Set up the mode, clock, and range of a PWM channel for the chip.
+ */
+static void setupPwmChannel(int gpioPin, const led_strip_t *strip)
+{
+  const led_chip_t *chip = strip->chip;
+
+  if (strip->mode == LED_MODE_SERIAL) {
+    /* the clock of a sub-bit */
+    long long khz = (long long)PWM_SOURCE_KHZ * chip->cycleNs;
+    long long div = (khz + 500000LL * chip->subbits) /
+                    (1000000LL * chip->subbits);
+    pwmSetModeSerializer(gpioPin);
+    pwmSetClock((int)div);
+    pwmSetRange(gpioPin, SERIAL_RANGE);
+  } else {
+    pwmSetModeMS(gpioPin);	/* mark:space mode */
+    pwmSetClock(PWM_CLOCK_DIV);
+    pwmSetRange(gpioPin, NS_TO_CLOCKS(chip->cycleNs));
+  }
+}
+
+/**
+ * The number of words needed for n LEDs and the RESET code.
+ */
+static int nWords(const led_strip_t *strip, int n, int rst)
+{
+  int bits = n * strip->bytesPerLed * RGB_BITS;
+  if (strip->mode == LED_MODE_SERIAL) {
+    return (SERIAL_N_WORDS_ENC(&strip->encoder, bits) +
+            SERIAL_N_WORDS_ENC(&strip->encoder, rst));
+  } else {
+    return bits + rst;
+  }
+}
+
+/**
+ * Allocate a strip and its DMA channel,
+ * whose memory is sized for a frame of the strip.
+ * If nPar > 0, the strip is nPar strips of n1 LEDs on the GPIO,
+ * and the caller opens the DMA channel.
+ */
+static led_strip_t *allocStrip(int n1, int n2, int nCh, int mode, int chip,
+                               int nPar)
+{
+  led_strip_t *strip;
+  int w1, w2, i;
+
+  if (n1 < 0 || n2 < 0) { return 0; }
+  if (mode != LED_MODE_MS && mode != LED_MODE_SERIAL) { return 0; }
+  if (chip < 0 || chip >= N_CHIPS) { return 0; }
+
+  strip = calloc(1, sizeof(led_strip_t));
+  if (strip == 0) { return 0; }
+  strip->nLed = (nPar > 0 ? n1 * nPar : n1 + n2);
+  strip->nCh = nCh;
+  strip->chLed[0] = (nPar > 0 ? strip->nLed : n1);
+  strip->chLed[1] = n2;
+  strip->nPar = nPar;
+  strip->parLen = n1;
+  strip->mode = mode;
+  strip->chip = &chips[chip];
+  strip->chOrder[0] = strip->chOrder[1] = strip->chip->order;
+  strip->bytesPerLed = strip->chip->bytesPerLed;
+  strip->rstBits = ((strip->chip->resetNs + strip->chip->cycleNs - 1) /
+                    strip->chip->cycleNs);
+  strip->dirtyLo = strip->nLed;
+  strip->dirtyHi = 0;
+  strip->sentAt = -1;
+  strip->gamma100 = 100;
+  strip->brightness = RGB_MAX;
+  strip->powerScale = POWER_ONE;
+  for (i = 0; i <= RGB_MAX + 1; i++) {
+    strip->corrLut[i] = (i > RGB_MAX ? RGB_MAX : i) << 8;  /* no correction */
+  }
+  ledEncoderInit(&strip->encoder, NS_TO_CLOCKS(strip->chip->t0hNs),
+                 NS_TO_CLOCKS(strip->chip->t1hNs));
+  ledEncoderSetSerial(&strip->encoder, strip->chip->subbits,
+                      strip->chip->code0, strip->chip->code1);
+  /* the LEDs filling whole words (1, 2, 4, ... LEDs) */
+  strip->ledAlign = 1;
+  while (strip->ledAlign * strip->bytesPerLed * RGB_BITS *
+         strip->chip->subbits % 32 != 0) {
+    strip->ledAlign *= 2;
+  }
+
+  strip->color = calloc(strip->nLed + 1, sizeof(unsigned int));
+  if (nPar == 0) {
+    w1 = nWords(strip, n1, strip->rstBits);
+    w2 = nWords(strip, n2, strip->rstBits);
+    strip->dma = pwmDmaOpenSize(-1, nCh == 1 ? w1 : 2 * (w1 > w2 ? w1 : w2));
+  }
+  if (strip->color == 0 || (nPar == 0 && strip->dma == 0)) {
+    pwmDmaClose(strip->dma);
+    free(strip->color);
+    free(strip);
+    return 0;
+  }
+  return strip;
+}
+
+/**
+ * Create a LED strip of WS2812B: set up the hardware for it.
  * \param gpioPin  GPIO-number for the LED strip.
  * \param n        The number of LEDs in the LED strip.
- * \return  0 for success, -1 for failure.
+ * \param mode     LED_MODE_MS or LED_MODE_SERIAL (see ledSetMode()).
+ * \return  The strip; 0 for failure.
  */
-int ledSetup(int gpioPin, int n)
+led_strip_t *ledStripCreate(int gpioPin, int n, int mode)
 {
-  if (setupGpio() == -1) {
-    return -1;
+  return ledStripCreateChip(gpioPin, n, mode, LED_CHIP_WS2812B);
+}
+
+/**
+ * Create a LED strip of a type of chip: set up the hardware for it.
+ * The timing, the order of R,G,B, and the bytes per LED come from
+ * the chip.
+ * \param gpioPin  GPIO-number for the LED strip.
+ * \param n        The number of LEDs in the LED strip.
+ * \param mode     LED_MODE_MS or LED_MODE_SERIAL (see ledSetMode()).
+ * \param chip     LED_CHIP_WS2812B, LED_CHIP_SK6812_RGBW, etc.
+ * \return  The strip; 0 for failure.
+ */
+led_strip_t *ledStripCreateChip(int gpioPin, int n, int mode, int chip)
+{
+  led_strip_t *strip = allocStrip(n, 0, 1, mode, chip, 0);
+  if (strip == 0) { return 0; }
+  if (pinModePwmFifo(gpioPin) == -1) {
+    ledStripDestroy(strip);
+    return 0;
   }
-  pinModePwmFifo(gpioPin);
-  pwmSetModeMS(gpioPin);	/* mark:space mode */
-  pwmSetClock(PWM_CLOCK_DIV);
-  pwmSetRange(gpioPin, T_CYCLE);
+  setupPwmChannel(gpioPin, strip);
+  return strip;
+}
 
-  if (n < 0) { return -1; }
-  if (n > MAX_N_LED) { return -1; }
-  nLed = n;
+/**
+ * Create two LED strips of WS2812B driven by the two PWM channels.
+ * Both strips are sent by one DMA transfer at the same time.
+ * LED 0..n1-1 are on the first strip, and n1..n1+n2-1 on the second.
+ * \param gpioPin1  GPIO-number for the first strip (12 or 18).
+ * \param n1        The number of LEDs in the first strip.
+ * \param gpioPin2  GPIO-number for the second strip (13 or 19).
+ * \param n2        The number of LEDs in the second strip.
+ * \param mode      LED_MODE_MS or LED_MODE_SERIAL (see ledSetMode()).
+ * \return  The strip; 0 for failure.
+ */
+led_strip_t *ledStripCreateDual(int gpioPin1, int n1, int gpioPin2, int n2,
+                                int mode)
+{
+  return ledStripCreateDualChip(gpioPin1, n1, gpioPin2, n2, mode,
+                                LED_CHIP_WS2812B);
+}
+
+/**
+ * Create two LED strips of a type of chip driven by the two PWM channels
+ * (see ledStripCreateDual() and ledStripCreateChip()).
+ * \return  The strip; 0 for failure.
+ */
+led_strip_t *ledStripCreateDualChip(int gpioPin1, int n1,
+                                    int gpioPin2, int n2, int mode, int chip)
+{
+  led_strip_t *strip = allocStrip(n1, n2, 2, mode, chip, 0);
+  if (strip == 0) { return 0; }
+  if (pinModePwmFifoDual(gpioPin1, gpioPin2) == -1) {
+    ledStripDestroy(strip);
+    return 0;
+  }
+  setupPwmChannel(gpioPin1, strip);
+  setupPwmChannel(gpioPin2, strip);
+  return strip;
+}
+
+/**
+ * Create up to LED_PAR_MAX strips of a type of chip driven in parallel
+ * by any GPIO pins: the DMA writes the bits of all the strips to
+ * GPSET0 and GPCLR0, paced by the PWM (see pwmDmaOpenGpio()), so they
+ * are sent in the time of one strip.  The waveform of a bit is that of
+ * the serializer mode (e.g. 3 steps of 0.4us for WS2812B).
+ * LED 0..n-1 are on the first pin, n..2n-1 on the second, and so on.
+ * The PWM is used as the pacer, so PWM strips cannot be used at once;
+ * the streaming mode is not supported.
+ * \param pins   GPIO-numbers (0..31) of the strips.
+ * \param nPins  The number of the strips (1..LED_PAR_MAX).
+ * \param n      The number of LEDs of each strip.
+ * \param chip   LED_CHIP_WS2812B, LED_CHIP_SK6812_RGBW, etc.
+ * \return  The strip; 0 for failure.
+ */
+led_strip_t *ledStripCreateParallel(const int *pins, int nPins, int n,
+                                    int chip)
+{
+  led_strip_t *strip;
+  const led_chip_t *c;
+  uint32_t mask = 0;
+  int s, step, rst;
+
+  if (pins == 0 || nPins < 1 || nPins > LED_PAR_MAX) { return 0; }
+  for (s = 0; s < nPins; s++) {
+    if (pins[s] < 0 || pins[s] > 31 || (mask & (1u << pins[s])) != 0) {
+      return 0;
+    }
+    mask |= 1u << pins[s];
+  }
+  strip = allocStrip(n, 0, 1, LED_MODE_MS, chip, nPins);
+  if (strip == 0) { return 0; }
+  for (s = 0; s < nPins; s++) {
+    strip->parPins[s] = 1u << pins[s];
+  }
+
+  /* a PWM word per step of the waveform; the RESET code leads a frame */
+  c = strip->chip;
+  step = NS_TO_CLOCKS(c->cycleNs / c->subbits);
+  rst = (int)(((long long)c->resetNs * PWM_CLOCK_KHZ + 1000000LL * step - 1) /
+              (1000000LL * step));
+  strip->dma = pwmDmaOpenGpio(-1, n * strip->bytesPerLed * RGB_BITS, mask,
+                              c->subbits, c->code0, c->code1, rst);
+  if (strip->dma == 0 || pwmSetPacer(PWM_CLOCK_DIV, step) == -1) {
+    ledStripDestroy(strip);
+    return 0;
+  }
+  for (s = 0; s < nPins; s++) {
+    pinModeOutput(pins[s]);
+  }
+  return strip;
+}
+
+/**
+ * Release a strip: the DMA channel is closed after the current
+ * transmission (the LEDs are not turned off; see ledStripClearAll()).
+ */
+void ledStripDestroy(led_strip_t *strip)
+{
+  if (strip == 0) { return; }
+  pwmDmaClose(strip->dma);
+  ledPoolDestroy(strip->pool);
+  free(strip->color);
+  free(strip->color16);
+  free(strip->ditherErr);
+  free(strip);
+}
+
+/**
+ * Set the transmission order of R,G,B of a strip.
+ * Call this function before setting colors.
+ * \param strip  The strip.
+ * \param ch     0, or 1 for the second strip of ledStripCreateDual().
+ * \param order  LED_ORDER_GRB or LED_ORDER_RGB
+ *               (the default depends on the chip; GRB for WS2812B).
+ * \return  0 for success, -1 for failure.
+ */
+int ledStripSetColorOrder(led_strip_t *strip, int ch, int order)
+{
+  if (strip == 0) { return -1; }
+  if (ch < 0 || ch > 1) { return -1; }
+  if (order != LED_ORDER_GRB && order != LED_ORDER_RGB) { return -1; }
+  strip->chOrder[ch] = order;
   return 0;
 }
 
 /**
- * Cleaning up: call this function at the end.
+ * The number of LEDs of a strip.
  */
-void ledCleanup()
+int ledStripLength(const led_strip_t *strip)
 {
-  ledClearAll();  /* Turn off all lights! */
-  cleanupGpio();
+  return (strip == 0 ? 0 : strip->nLed);
+}
+
+/**
+ * The time to transmit a frame of a strip (including the RESET code),
+ * i.e. the reciprocal of the maximum frame rate.
+ * \return  The time in microseconds; -1 for failure.
+ */
+int ledStripFrameUs(const led_strip_t *strip)
+{
+  long long bits;
+  int n;
+  if (strip == 0) { return -1; }
+  n = (strip->chLed[0] > strip->chLed[1] ? strip->chLed[0] : strip->chLed[1]);
+  if (strip->nPar > 0) { n = strip->parLen; }
+  bits = (long long)n * strip->bytesPerLed * RGB_BITS + strip->rstBits;
+  return (int)(bits * strip->chip->cycleNs / 1000);
 }
 
 #define PACK_COLOR(h,m,l)  (((h)<<(2*RGB_BITS))|((m)<<RGB_BITS)|(l))
+#define CLAMP(x,lo,hi)  ((x) < (lo) ? (lo) : (x) > (hi) ? (hi) : (x))
+
+/** Mark LEDs lo..hi-1 as changed */
+static void markDirty(led_strip_t *strip, int lo, int hi)
+{
+  if (lo < strip->dirtyLo) { strip->dirtyLo = lo; }
+  if (hi > strip->dirtyHi) { strip->dirtyHi = hi; }
+}
+
+/**
+ * The sum of the corrected values of a packed color
+ * (of 3 or 4 bytes; corrLut[0] is 0 for the unused byte)
+ */
+#define COLOR_POWER(strip,c) ((strip)->corrLut[(c) >> 24] + \
+                              (strip)->corrLut[((c) >> 16) & 0xff] + \
+                              (strip)->corrLut[((c) >> 8) & 0xff] + \
+                              (strip)->corrLut[(c) & 0xff])
+
+/** Compute the sum of the corrected values of all LEDs */
+static void sumPower(led_strip_t *strip)
+{
+  unsigned long long sum = 0;
+  int i;
+  for (i = 0; i < strip->nLed; i++) {
+    sum += COLOR_POWER(strip, strip->color[i]);
+  }
+  strip->powerSum = sum;
+}
+
+/** Store a packed color (and remember if it is changed) */
+static void storeColor(led_strip_t *strip, int led, unsigned int c)
+{
+  if (strip->color[led] != c) {
+    if (strip->budgetMa > 0) {
+      strip->powerSum += COLOR_POWER(strip, c);
+      strip->powerSum -= COLOR_POWER(strip, strip->color[led]);
+    }
+    strip->color[led] = c;
+    markDirty(strip, led, led + 1);
+  }
+  if (strip->color16 != 0) {
+    int nb = strip->bytesPerLed, k;
+    uint16_t *c16 = strip->color16 + nb * led;
+    for (k = 0; k < nb; k++) {
+      uint16_t x = ((c >> (8 * (nb - 1 - k))) & 0xff) * 257;
+      if (c16[k] != x) {
+        c16[k] = x;
+        markDirty(strip, led, led + 1);
+      }
+    }
+  }
+}
+
+/**
+ * Forget the contents of the DMA buffers:
+ * the whole frame is encoded again by the next ledStripSend().
+ */
+static void invalidateBuffers(led_strip_t *strip)
+{
+  memset(strip->enc, 0, sizeof(strip->enc));
+  markDirty(strip, 0, strip->nLed);
+}
 
 /**
  * Set the color of one LED (not sent to the strip in this function)
+ * \param strip The strip.
  * \param led  The id of an LED (0〜)
  * \param r    The value of red   (0〜255)
  * \param g    The value of green (  "   )
  * \param b    The value of blue  (  "   )
  */
-void ledSetColor(int led, int r, int g, int b)
+void ledStripSetColor(led_strip_t *strip, int led, int r, int g, int b)
 {
-  if (led < 0 || led >= nLed) { return; }
-  if (r < 0) { r = 0; }
-  if (g < 0) { g = 0; }
-  if (b < 0) { b = 0; }
-  if (r > RGB_MAX) { r = RGB_MAX; }
-  if (g > RGB_MAX) { g = RGB_MAX; }
-  if (b > RGB_MAX) { b = RGB_MAX; }
+  ledStripSetColorRGBW(strip, led, r, g, b, 0);
+}
 
-#if COLOR_ORDER == ORDER_GRB
-  ledColor[led] = PACK_COLOR(g, r, b);
-#else
-  ledColor[led] = PACK_COLOR(r, g, b);
-#endif
+/**
+ * Set the color of one LED with white (not sent to the strip in this
+ * function); `w` is ignored unless the chip is RGBW.
+ * \param strip The strip.
+ * \param led  The id of an LED (0〜)
+ * \param r    The value of red   (0〜255)
+ * \param g    The value of green (  "   )
+ * \param b    The value of blue  (  "   )
+ * \param w    The value of white (  "   )
+ */
+void ledStripSetColorRGBW(led_strip_t *strip, int led,
+                          int r, int g, int b, int w)
+{
+  unsigned int c;
+
+  if (strip == 0) { return; }
+  if (led < 0 || led >= strip->nLed) { return; }
+  r = CLAMP(r, 0, RGB_MAX);
+  g = CLAMP(g, 0, RGB_MAX);
+  b = CLAMP(b, 0, RGB_MAX);
+
+  if (strip->chOrder[led < strip->chLed[0] ? 0 : 1] == LED_ORDER_GRB) {
+    c = PACK_COLOR(g, r, b);
+  } else {
+    c = PACK_COLOR(r, g, b);
+  }
+  if (strip->bytesPerLed == 4) {
+    c = (c << RGB_BITS) | CLAMP(w, 0, RGB_MAX);
+  }
+  storeColor(strip, led, c);
 }
 
 /**
- * Send the color data to the LED strip!
+ * Set the colors of consecutive LEDs at once
+ * (not sent to the strip in this function).
+ * \param strip  The strip.
+ * \param start  The id of the first LED.
+ * \param count  The number of LEDs.
+ * \param pixels count * 3 bytes of colors
+ *               (count * 4 bytes for RGBW chips, W being the last;
+ *               see ledStripBytesPerLed()).
+ * \param order  The order of R,G,B in `pixels`
+ *               (LED_ORDER_RGB or LED_ORDER_GRB).
+ * \return  The number of LEDs set (LEDs out of the strip are ignored).
  */
-void ledSend()
+int ledStripSetPixels(led_strip_t *strip, int start, int count,
+                      const unsigned char *pixels, int order)
 {
-  static unsigned char buf[MAX_N_LED * 3 * RGB_BITS + RST_BITS];
-  int i, j;
-  for (i = 0; i < nLed; i++) {
-    int col = ledColor[i];
-    int mask = (1 << (3 * RGB_BITS - 1));
-    for (j = 0; j < 3 * RGB_BITS; j++) {
-      buf[i * 3 * RGB_BITS + j] = ((col & mask) ? T1H : T0H);
-      mask >>= 1;
+  int ch, i, end, nb, set = 0;
+  unsigned int c;
+
+  if (strip == 0 || pixels == 0) { return 0; }
+  nb = strip->bytesPerLed;
+  if (start < 0) {
+    pixels += -start * nb;
+    count += start;
+    start = 0;
+  }
+  end = start + count;
+  if (end > strip->nLed) { end = strip->nLed; }
+
+  for (ch = 0; ch < strip->nCh; ch++) {
+    int lo = (ch == 0 ? 0 : strip->chLed[0]);
+    int hi = (ch == 0 ? strip->chLed[0] : strip->nLed);
+    if (lo < start) { lo = start; }
+    if (hi > end)   { hi = end; }
+
+    /* GRB and RGB differ only in the first two bytes */
+    if (nb == 4) {
+      int swap = (order != strip->chOrder[ch]);
+      for (i = lo; i < hi; i++, pixels += 4) {
+        c = PACK_COLOR(pixels[swap], pixels[!swap], pixels[2]);
+        storeColor(strip, i, (c << RGB_BITS) | pixels[3]);
+      }
+    } else if (order == strip->chOrder[ch]) {
+      for (i = lo; i < hi; i++, pixels += 3) {
+        c = PACK_COLOR(pixels[0], pixels[1], pixels[2]);
+        storeColor(strip, i, c);
+      }
+    } else {
+      for (i = lo; i < hi; i++, pixels += 3) {
+        c = PACK_COLOR(pixels[1], pixels[0], pixels[2]);
+        storeColor(strip, i, c);
+      }
     }
+    if (hi > lo) { set += hi - lo; }
+  }
+  return set;
+}
+
+/**
+ * The number of bytes of a pixel given to ledStripSetPixels():
+ * 3, or 4 for RGBW chips.
+ */
+int ledStripBytesPerLed(const led_strip_t *strip)
+{
+  return (strip == 0 ? 0 : strip->bytesPerLed);
+}
+
+/**
+ * Encode packed colors of n LEDs into dst (every `stride` words).
+ * \return  The number of words.
+ */
+static int encodeColors(const led_strip_t *strip, uint32_t *dst,
+                        const unsigned int *colors, int n, int rst,
+                        int stride)
+{
+  if (strip->mode == LED_MODE_SERIAL) {
+    return ledEncodeSerial(&strip->encoder, dst, colors, n,
+                           strip->bytesPerLed, rst, stride);
+  } else {
+    return ledEncodeMS(&strip->encoder, dst, colors, n,
+                       strip->bytesPerLed, rst, stride);
   }
-  /* RESET code */
-  for (i = 0; i < RST_BITS; i++) {
-    buf[nLed * 3 * RGB_BITS + i] = 0;
+}
+
+/**
+ * Apply the color correction to n LEDs from `first`
+ * and pack the results into dst.
+ */
+static void correctColors(led_strip_t *strip, unsigned int *dst,
+                          int first, int n)
+{
+  const uint16_t *lut = strip->corrLut;
+  int nb = strip->bytesPerLed;
+  uint8_t *err = (strip->ditherErr == 0 ? 0 : strip->ditherErr + nb * first);
+  int i, k;
+
+  for (i = 0; i < n; i++) {
+    unsigned int c = 0;
+    for (k = 0; k < nb; k++) {
+      unsigned int x;
+      if (strip->color16 != 0) {
+        /* interpolate the table (an 8-bit value x is kept as x * 257) */
+        unsigned int x16 = strip->color16[nb * (first + i) + k];
+        unsigned int hi = x16 / 257, lo = x16 % 257;
+        x = lut[hi] + (lut[hi + 1] - lut[hi]) * lo / 257;
+      } else {
+        x = lut[(strip->color[first + i] >> (8 * (nb - 1 - k))) & 0xff];
+      }
+      if (strip->powerScale != POWER_ONE) {
+        x = x * strip->powerScale / POWER_ONE;
+      }
+      if (err != 0) {
+        /* temporal dithering: carry the fraction to the next frame */
+        x += err[nb * i + k];
+        err[nb * i + k] = x & 0xff;
+        x >>= 8;
+      } else {
+        x = (x + 0x80) >> 8;
+      }
+      c = (c << 8) | x;
+    }
+    dst[i] = c;
   }
-  pwmWriteBlock(buf, nLed * 3 * RGB_BITS + RST_BITS);
 }
 
 /**
- * Turn off all lights.
+ * Encode the colors of n LEDs from `first` into dst
+ * (every `stride` words), with the color correction if any.
+ * \return  The number of words.
  */
-void ledClearAll()
+static int encode(led_strip_t *strip, uint32_t *dst, int first, int n,
+                  int rst, int stride)
 {
-  int led;
-  for (led = 0; led < nLed; led++) {
-    ledSetColor(led, 0, 0, 0);
+  unsigned int colors[CORR_CHUNK];
+  int i, k, nw = 0;
+
+  if (!strip->correct && strip->powerScale == POWER_ONE) {
+    return encodeColors(strip, dst, strip->color + first, n, rst, stride);
+  }
+  if (n == 0) {
+    return encodeColors(strip, dst, strip->color, 0, rst, stride);
   }
-  ledSend();
+  /* CORR_CHUNK LEDs at a time, while they are in the cache */
+  for (i = 0; i < n; i += k) {
+    k = (n - i < CORR_CHUNK ? n - i : CORR_CHUNK);
+    correctColors(strip, colors, first + i, k);
+    nw += encodeColors(strip, dst + stride * nw, colors, k,
+                       (i + k == n ? rst : 0), stride);
+  }
+  return nw;
 }
 
 /**
- * Set the color of one LED in HSB (not sent to the strip in this function)
- * \param led  The id of an LED (0〜)
- * \param h    Hue        (0〜359)
- * \param s    Saturation (0〜255)
- * \param v    Brightness (  "   )
+ * Encode the colors of LEDs a..b-1 of every parallel strip into their
+ * bit planes (with the color correction if any).
  */
-void ledSetColorHSB(int led, int h, int s, int v)
+static void encodeParallel(led_strip_t *strip, uint32_t *buf, int a, int b)
 {
-  int hgroup;
-  double f, ss;
-  int p, q, t, r, g, b;
+  unsigned int colors[LED_PAR_MAX][CORR_CHUNK];
+  const unsigned int *src[LED_PAR_MAX];
+  int bits = strip->bytesPerLed * RGB_BITS;
+  int i, k, s;
 
-  /* constrain the values within ranges */
-  if (h < 0)   { h = 0; }
-  if (h > 359) { h = 359; }
-  if (s < 0)   { s = 0; }
-  if (v < 0)   { v = 0; }
-  if (s > RGB_MAX) { s = RGB_MAX; }
-  if (v > RGB_MAX) { v = RGB_MAX; }
-
-  /* hue grouping (0..5) */
-  hgroup = (h / 60) % 6;
-
-  /* convert into r,g,b */
-  f  = (double)(h % 60) / 60;
-  ss = (double)s / RGB_MAX;
-  p  = (int)(v * (1.0 - ss));
-  q  = (int)(v * (1.0 - f * ss));
-  t  = (int)(v * (1.0 - (1.0 - f) * ss));
-  switch (hgroup) {
-  case 0: r = v; g = t; b = p; break;
-  case 1: r = q; g = v; b = p; break;
-  case 2: r = p; g = v; b = t; break;
-  case 3: r = p; g = q; b = v; break;
-  case 4: r = t; g = p; b = v; break;
-  case 5: r = v; g = p; b = q; break;
-  }
-
-  /* use the results */
-  ledSetColor(led, r, g, b);
+  for (i = a; i < b; i += k) {
+    k = (b - i < CORR_CHUNK ? b - i : CORR_CHUNK);
+    for (s = 0; s < strip->nPar; s++) {
+      int first = s * strip->parLen + i;
+      if (!strip->correct && strip->powerScale == POWER_ONE) {
+        src[s] = strip->color + first;
+      } else {
+        correctColors(strip, colors[s], first, k);
+        src[s] = colors[s];
+      }
+    }
+    ledEncodeParallel(buf + bits * i, src, strip->parPins, strip->nPar, k,
+                      strip->bytesPerLed);
+  }
+}
+
+/* A part of a frame encoded in shards (see encodeSharded()) */
+typedef struct {
+  led_strip_t *strip;
+  uint32_t *dst;
+  int first, n, rst, stride;
+} shard_job_t;
+
+/**
+ * The first LED of a shard of n LEDs, at a boundary of words.
+ */
+static int shardStart(const led_strip_t *strip, int n, int shard,
+                      int nShards)
+{
+  if (shard >= nShards) { return n; }
+  return (int)((long long)n * shard / nShards) / strip->ledAlign *
+         strip->ledAlign;
+}
+
+/**
+ * Encode a shard of a job into its own words of the buffer
+ * (run by the threads of the pool).
+ */
+static void encodeShard(void *arg, int shard, int nShards)
+{
+  const shard_job_t *job = arg;
+  led_strip_t *strip = job->strip;
+  int a = shardStart(strip, job->n, shard, nShards);
+  int b = shardStart(strip, job->n, shard + 1, nShards);
+
+  if (strip->nPar > 0) {
+    encodeParallel(strip, job->dst, job->first + a, job->first + b);
+  } else {
+    encode(strip, job->dst + job->stride * nWords(strip, a, 0),
+           job->first + a, b - a, (b == job->n ? job->rst : 0),
+           job->stride);
+  }
+}
+
+/**
+ * The number of shards for encoding `leds` LEDs:
+ * one per SHARD_LEDS LEDs, up to the threads of the pool
+ * (created here for the first long frame).
+ */
+static int countShards(led_strip_t *strip, int leds)
+{
+  int k = leds / SHARD_LEDS;
+
+  if (k <= 1 || strip->nThreads == 1) { return 1; }
+  if (strip->pool == 0) {
+    strip->pool = ledPoolCreate(strip->nThreads);
+    if (strip->pool == 0) {
+      strip->nThreads = 1;	/* do not try again */
+      return 1;
+    }
+  }
+  return (k < ledPoolThreads(strip->pool) ? k : ledPoolThreads(strip->pool));
+}
+
+/**
+ * Encode the colors of n LEDs from `first` into dst like encode()
+ * (or LEDs first..first+n-1 of every parallel strip into the buffer
+ * dst like encodeParallel()), splitting them into shards encoded on
+ * several cores if there are many.  Each shard writes its own words.
+ */
+static void encodeSharded(led_strip_t *strip, uint32_t *dst, int first,
+                          int n, int rst, int stride)
+{
+  shard_job_t job;
+  int leds = (strip->nPar > 0 ? n * strip->nPar : n);
+
+  job.strip = strip;
+  job.dst = dst;
+  job.first = first;
+  job.n = n;
+  job.rst = rst;
+  job.stride = stride;
+  ledPoolRun(strip->pool, encodeShard, &job, countShards(strip, leds));
+}
+
+/**
+ * Encode the colors of LEDs lo..hi-1 again into a buffer
+ * holding a frame of the strip.
+ */
+static void encodeRange(led_strip_t *strip, uint32_t *buf,
+                        int lo, int hi)
+{
+  int ch, first = 0;
+
+  if (strip->nPar > 0) {
+    /* the same LEDs of all the strips share the words */
+    int n = strip->parLen;
+    if (hi - lo >= n || lo / n != (hi - 1) / n) {
+      encodeSharded(strip, buf, 0, n, 0, 1);
+    } else {
+      encodeSharded(strip, buf, lo % n, (hi - 1) % n + 1 - lo % n, 0, 1);
+    }
+    return;
+  }
+
+  for (ch = 0; ch < strip->nCh; ch++) {
+    int n = strip->chLed[ch];
+    int a = lo - first, b = hi - first, offset;
+    if (a < 0) { a = 0; }
+    if (b > n) { b = n; }
+    if (a < b) {
+      if (strip->mode == LED_MODE_SERIAL) {
+        a = a / strip->ledAlign * strip->ledAlign;
+        b = (b + strip->ledAlign - 1) / strip->ledAlign * strip->ledAlign;
+        if (b > n) { b = n; }
+      }
+      offset = nWords(strip, a, 0);
+      encodeSharded(strip, buf + ch + strip->nCh * offset, first + a, b - a,
+                    0, strip->nCh);
+    }
+    first += n;
+  }
+}
+
+/**
+ * Update the encoded frame in a DMA buffer.
+ * Only the LEDs changed since the buffer was filled are encoded,
+ * unless the buffer is new to the strip.
+ */
+static void updateBuffer(led_strip_t *strip, uint32_t *buf, int rst,
+                         const int *w, int n)
+{
+  int ch, i, e, found = -1;
+
+  /* the LEDs changed since the last frame are out of date in every buffer */
+  for (e = 0; e < N_ENC_BUFS; e++) {
+    if (strip->enc[e].buf == buf) { found = e; }
+    if (strip->dirtyLo >= strip->dirtyHi) { continue; }
+    if (strip->enc[e].lo >= strip->enc[e].hi) {
+      strip->enc[e].lo = strip->dirtyLo;
+      strip->enc[e].hi = strip->dirtyHi;
+    } else {
+      if (strip->dirtyLo < strip->enc[e].lo) {
+        strip->enc[e].lo = strip->dirtyLo;
+      }
+      if (strip->dirtyHi > strip->enc[e].hi) {
+        strip->enc[e].hi = strip->dirtyHi;
+      }
+    }
+  }
+  strip->dirtyLo = strip->nLed;
+  strip->dirtyHi = 0;
+
+  if (found >= 0) {
+    if (strip->enc[found].lo < strip->enc[found].hi) {
+      encodeRange(strip, buf, strip->enc[found].lo, strip->enc[found].hi);
+    }
+  } else {
+    /* the whole frame */
+    if (strip->nPar > 0) {
+      encodeSharded(strip, buf, 0, strip->parLen, 0, 1);
+    } else if (strip->nCh == 1) {
+      encodeSharded(strip, buf, 0, strip->nLed, rst, 1);
+    } else {
+      encodeSharded(strip, buf,     0,               strip->chLed[0], rst, 2);
+      encodeSharded(strip, buf + 1, strip->chLed[0], strip->chLed[1], rst, 2);
+      for (ch = 0; ch < 2; ch++) {
+        for (i = w[ch]; i < n / 2; i++) {
+          buf[2 * i + ch] = 0;
+        }
+      }
+    }
+    found = strip->encNext;
+    strip->encNext = (found + 1) % N_ENC_BUFS;
+    strip->enc[found].buf = buf;
+  }
+  strip->enc[found].lo = strip->enc[found].hi = 0;
+}
+
+/**
+ * Estimate the current of the frame, and choose the scale of the colors
+ * so that it is within the budget (O(1) with the sum kept by
+ * storeColor()).
+ */
+static void limitPower(led_strip_t *strip)
+{
+  unsigned int scale = POWER_ONE;
+
+  if (strip->budgetMa > 0) {
+    long long idle = (long long)strip->idleMa * strip->nLed;
+    unsigned long long lit = strip->channelMa * strip->powerSum;
+    if (idle + (long long)(lit / CORR_MAX) > strip->budgetMa) {
+      scale = (strip->budgetMa <= idle ? 0 :
+               (unsigned long long)(strip->budgetMa - idle) * CORR_MAX *
+               POWER_ONE / lit);
+    }
+  }
+  if (scale != strip->powerScale) {
+    strip->powerScale = scale;
+    markDirty(strip, 0, strip->nLed);
+  }
+}
+
+static long long nowMs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Send the color data to the LED strip!
+ * The colors are encoded directly into the DMA buffer;
+ * the LEDs not changed since the buffer was used last are not
+ * encoded again, and an unchanged frame is not sent at all
+ * (see ledStripSetRefresh()).
+ * For two strips, the words for them are interleaved
+ * and the shorter one is padded with 0.
+ * \return  0 for success, -1 if the frame does not fit the DMA buffer.
+ */
+int ledStripSend(led_strip_t *strip)
+{
+  uint32_t *buf;
+  int rst;
+  int w[2] = { 0, 0 };
+  int ch, n;
+
+  if (strip == 0) { return -1; }
+  if (strip->ditherErr != 0) {
+    markDirty(strip, 0, strip->nLed);	/* every frame differs */
+  }
+  limitPower(strip);
+  if (strip->dirtyLo >= strip->dirtyHi && strip->sentAt >= 0 &&
+      strip->refreshMs >= 0) {
+    /* the same frame as the last one (the ring repeats it by itself) */
+    if (strip->streaming || strip->refreshMs == 0 ||
+        nowMs() - strip->sentAt < strip->refreshMs) {
+      return 0;
+    }
+  }
+  /* the ring sends RESET itself */
+  rst = (strip->streaming ? 0 : strip->rstBits);
+  for (ch = 0; ch < strip->nCh; ch++) {
+    w[ch] = nWords(strip, strip->chLed[ch], rst);
+  }
+  n = (strip->nCh == 1 ? w[0] : 2 * (w[0] > w[1] ? w[0] : w[1]));
+  if (strip->nPar > 0) {
+    /* a word per bit; the DMA sends RESET itself */
+    n = strip->parLen * strip->bytesPerLed * RGB_BITS;
+  }
+  buf = (strip->streaming ? pwmDmaRingAcquire(strip->dma, n)
+                          : pwmDmaGetBuffer(strip->dma, n));
+  if (buf == 0) { return -1; }
+
+  updateBuffer(strip, buf, rst, w, n);
+  if (strip->streaming) {
+    pwmDmaRingCommit(strip->dma, n);
+  } else {
+    pwmDmaSend(strip->dma, n);
+  }
+  strip->sentAt = nowMs();
+  return 0;
+}
+
+/**
+ * Set how ledStripSend() handles a frame identical to the last one.
+ * \param strip       The strip.
+ * \param intervalMs  0: never send it (default);
+ *                    > 0: send it if this many milliseconds have passed
+ *                    since the last transmission (e.g. to recover LEDs
+ *                    from noise or a power glitch);
+ *                    -1: always send it.
+ * \return  0 for success, -1 for failure.
+ */
+int ledStripSetRefresh(led_strip_t *strip, int intervalMs)
+{
+  if (strip == 0 || intervalMs < -1) { return -1; }
+  strip->refreshMs = intervalMs;
+  return 0;
+}
+
+/**
+ * Set the number of threads encoding a frame of a strip in ledStripSend().
+ * A frame is split into shards of at least SHARD_LEDS LEDs (1024), so
+ * shorter strips are always encoded by the caller alone; the worker
+ * threads are created for the first frame long enough.
+ * \param strip     The strip.
+ * \param nThreads  The threads including the caller (1..LED_POOL_MAX);
+ *                  1: encode in the caller only;
+ *                  0: as many as the online CPUs (default).
+ * \return  0 for success, -1 for failure.
+ */
+int ledStripSetThreads(led_strip_t *strip, int nThreads)
+{
+  if (strip == 0 || nThreads < 0 || nThreads > LED_POOL_MAX) { return -1; }
+  if (strip->pool != 0 && nThreads != strip->nThreads) {
+    ledPoolDestroy(strip->pool);
+    strip->pool = 0;
+  }
+  strip->nThreads = nThreads;
+  return 0;
+}
+
+/** Make the table of the color correction */
+static void updateCorrection(led_strip_t *strip)
+{
+  double gamma = strip->gamma100 / 100.0;
+  int i;
+
+  for (i = 0; i <= RGB_MAX; i++) {
+    strip->corrLut[i] = (uint16_t)(pow((double)i / RGB_MAX, gamma) *
+                                   strip->brightness / RGB_MAX * CORR_MAX +
+                                   0.5);
+  }
+  strip->corrLut[RGB_MAX + 1] = strip->corrLut[RGB_MAX];
+  strip->correct = (strip->gamma100 != 100 || strip->brightness != RGB_MAX ||
+                    strip->ditherErr != 0 || strip->color16 != 0);
+  if (strip->budgetMa > 0) {
+    sumPower(strip);
+  }
+  invalidateBuffers(strip);
+}
+
+/**
+ * Set the gamma of the color correction: a value x (0..255) of R, G, or B
+ * is sent as 255 * (x / 255)^gamma (e.g. 2.2 for a perceptually linear
+ * scale; 1.0 by default).
+ * \param strip     The strip.
+ * \param gamma100  The gamma multiplied by 100 (e.g. 220).
+ * \return  0 for success, -1 for failure.
+ */
+int ledStripSetGamma(led_strip_t *strip, int gamma100)
+{
+  if (strip == 0 || gamma100 <= 0) { return -1; }
+  strip->gamma100 = gamma100;
+  updateCorrection(strip);
+  return 0;
+}
+
+/**
+ * Set the global brightness of a strip, applied after the gamma.
+ * Use it with ledStripSetDither() to keep the gradation when dimmed.
+ * \param strip       The strip.
+ * \param brightness  0..255 (255 by default).
+ * \return  0 for success, -1 for failure.
+ */
+int ledStripSetBrightness(led_strip_t *strip, int brightness)
+{
+  if (strip == 0 || brightness < 0 || brightness > RGB_MAX) { return -1; }
+  strip->brightness = brightness;
+  updateCorrection(strip);
+  return 0;
+}
+
+/**
+ * Turn on/off the temporal dithering: the fractions of the corrected
+ * values (or of the colors set by ledStripSetColor16()) are carried to
+ * the next frame, so that the average over frames is more precise than
+ * 8 bits.  Every frame is encoded and sent while it is on, since they
+ * differ from each other; send frames continuously (e.g. with
+ * ledsched.h) for it to work.
+ * \param strip  The strip.
+ * \param on     1 to turn on, 0 to turn off (default).
+ * \return  0 for success, -1 for failure.
+ */
+int ledStripSetDither(led_strip_t *strip, int on)
+{
+  if (strip == 0) { return -1; }
+  if (on && strip->ditherErr == 0) {
+    strip->ditherErr = calloc(strip->bytesPerLed * strip->nLed + 1,
+                              sizeof(uint8_t));
+    if (strip->ditherErr == 0) { return -1; }
+  } else if (!on) {
+    free(strip->ditherErr);
+    strip->ditherErr = 0;
+  }
+  updateCorrection(strip);
+  return 0;
+}
+
+/**
+ * Set the color of one LED in 16 bits per channel
+ * (not sent to the strip in this function).
+ * The values are rounded into 8 bits while encoding,
+ * or dithered (see ledStripSetDither()).
+ * \param strip The strip.
+ * \param led  The id of an LED (0〜)
+ * \param r    The value of red   (0〜65535)
+ * \param g    The value of green (  "     )
+ * \param b    The value of blue  (  "     )
+ */
+void ledStripSetColor16(led_strip_t *strip, int led, int r, int g, int b)
+{
+  uint16_t *c16;
+  int i, k, nb;
+
+  if (strip == 0) { return; }
+  if (led < 0 || led >= strip->nLed) { return; }
+  nb = strip->bytesPerLed;
+  if (strip->color16 == 0) {
+    /* from now on, the colors are kept in 16 bits */
+    strip->color16 = malloc(nb * strip->nLed * sizeof(uint16_t) + 1);
+    if (strip->color16 == 0) { return; }
+    for (i = 0; i < strip->nLed; i++) {
+      for (k = 0; k < nb; k++) {
+        strip->color16[nb * i + k] =
+          ((strip->color[i] >> (8 * (nb - 1 - k))) & 0xff) * 257;
+      }
+    }
+    updateCorrection(strip);
+  }
+  r = CLAMP(r, 0, 0xffff);
+  g = CLAMP(g, 0, 0xffff);
+  b = CLAMP(b, 0, 0xffff);
+
+  /* the 8-bit colors are kept for ledStripClearAll() etc. */
+  ledStripSetColor(strip, led, r >> 8, g >> 8, b >> 8);
+  c16 = strip->color16 + nb * led;
+  if (strip->chOrder[led < strip->chLed[0] ? 0 : 1] == LED_ORDER_GRB) {
+    c16[0] = g;
+    c16[1] = r;
+  } else {
+    c16[0] = r;
+    c16[1] = g;
+  }
+  c16[2] = b;
+  markDirty(strip, led, led + 1);
+}
+
+/**
+ * Limit the current drawn by the strip:
+ * the current is estimated from the sum of the values of R, G, and B
+ * (after the color correction), and the frame is dimmed while encoding
+ * if it exceeds the budget.
+ * \param strip      The strip.
+ * \param channelMa  The current of one channel (R, G, or B) at 255 (mA;
+ *                   about 20 for WS2812B).
+ * \param idleMa     The current of one LED when it is black (mA).
+ * \param budgetMa   The maximum current of the strip (mA; 0: no limit).
+ * \return  0 for success, -1 for failure.
+ */
+int ledStripSetPowerLimit(led_strip_t *strip, int channelMa, int idleMa,
+                          int budgetMa)
+{
+  if (strip == 0 || channelMa < 0 || idleMa < 0 || budgetMa < 0) {
+    return -1;
+  }
+  strip->channelMa = channelMa;
+  strip->idleMa = idleMa;
+  strip->budgetMa = budgetMa;
+  if (budgetMa > 0) {
+    sumPower(strip);
+  }
+  return 0;
+}
+
+/**
+ * The current estimated from the colors set now, before being limited
+ * (see ledStripSetPowerLimit()).
+ * \return  The current in mA; -1 if the limiter is not set.
+ */
+int ledStripPowerMa(const led_strip_t *strip)
+{
+  if (strip == 0 || strip->budgetMa <= 0) { return -1; }
+  return (int)(strip->idleMa * strip->nLed +
+               strip->channelMa * strip->powerSum / CORR_MAX);
+}
+
+/**
+ * Start the streaming mode:
+ * the DMA keeps sending the latest frame without stopping,
+ * and ledStripSend() just puts a new frame into the ring.
+ * \return  0 for success, -1 for failure.
+ */
+int ledStripStreamStart(led_strip_t *strip)
+{
+  int rst;
+  if (strip == 0) { return -1; }
+  rst = nWords(strip, 0, strip->rstBits);
+  if (pwmDmaRingStart(strip->dma, rst * strip->nCh) == -1) { return -1; }
+  strip->streaming = 1;
+  invalidateBuffers(strip);	/* the frames have no RESET code */
+  return 0;
+}
+
+/**
+ * Stop the streaming mode (after the current frame is sent).
+ */
+void ledStripStreamStop(led_strip_t *strip)
+{
+  if (strip == 0) { return; }
+  pwmDmaRingStop(strip->dma);
+  strip->streaming = 0;
+  invalidateBuffers(strip);
+}
+
+/**
+ * The number of frames sent by ledStripSend() in the streaming mode
+ * that the DMA has started to transmit.
+ */
+unsigned int ledStripStreamConsumed(led_strip_t *strip)
+{
+  return (strip == 0 ? 0 : pwmDmaRingConsumed(strip->dma));
+}
+
+/**
+ * Wait until the frames sent by ledStripSend() have been transmitted
+ * (in the streaming mode: until the latest one has been started).
+ * The CPU sleeps until the predicted end of the transmission.
+ * \param strip      The strip.
+ * \param timeoutMs  Give up after this many milliseconds (-1: never).
+ * \return  0 for success, -1 for timeout or failure.
+ */
+int ledStripWaitSent(led_strip_t *strip, int timeoutMs)
+{
+  return (strip == 0 ? -1 : pwmDmaWaitSent(strip->dma, timeoutMs));
+}
+
+/**
+ * Set the colors of all the LEDs and send them.
+ * \param strip  The strip.
+ * \param pixels count * 3 or 4 bytes of colors (see ledStripSetPixels()).
+ * \param count  The number of LEDs in `pixels`.
+ * \param order  The order of R,G,B in `pixels`.
+ */
+void ledStripSendFrame(led_strip_t *strip, const unsigned char *pixels,
+                       int count, int order)
+{
+  ledStripSetPixels(strip, 0, count, pixels, order);
+  ledStripSend(strip);
+}
+
+/**
+ * Turn off all lights.
+ */
+void ledStripClearAll(led_strip_t *strip)
+{
+  int lo, hi;
+  if (strip == 0) { return; }
+  if (strip->color16 != 0) {
+    memset(strip->color16, 0,
+           strip->bytesPerLed * strip->nLed * sizeof(uint16_t));
+    markDirty(strip, 0, strip->nLed);
+  }
+  for (lo = 0; lo < strip->nLed && strip->color[lo] == 0; lo++) {
+    ;
+  }
+  for (hi = strip->nLed; hi > lo && strip->color[hi - 1] == 0; hi--) {
+    ;
+  }
+  if (lo < hi) {
+    memset(strip->color + lo, 0, (hi - lo) * sizeof(unsigned int));
+    markDirty(strip, lo, hi);
+  }
+  strip->powerSum = 0;
+  ledStripSend(strip);
+}
+
+/* the number of LEDs converted at once by ledStripSetColorsHSB() */
+#define HSB_CHUNK  64
+
+/* 0xRRGGBB <-> 0xGGRRBB */
+#define SWAP_RG(c)  ((((c) >> 8) & 0xff00) | (((c) << 8) & 0xff0000) | \
+                     ((c) & 0xff))
+
+/**
+ * Convert HSB into R,G,B packed as 0xRRGGBB, in integers only
+ * (the divisions by constants become multiplications).
+ * h (0..359), s and v (0..RGB_MAX) must be within the ranges.
+ * The result differs from the calculation in real numbers by 1 at most.
+ */
+static unsigned int hsbToRgb(unsigned int h, unsigned int s, unsigned int v)
+{
+  unsigned int hgroup = h / 60;	/* hue grouping (0..5) */
+  unsigned int f = h % 60;
+  unsigned int p, q, t, r, g, b;
+
+  p = v * (RGB_MAX - s) / RGB_MAX;
+  q = v * (60 * RGB_MAX - f * s) / (60 * RGB_MAX);
+  t = v * (60 * RGB_MAX - (60 - f) * s) / (60 * RGB_MAX);
+
+  /* without branches, so that a loop of this can be vectorized */
+  r = (hgroup == 0 || hgroup == 5 ? v : hgroup == 1 ? q : hgroup == 4 ? t : p);
+  g = (hgroup == 0 ? t : hgroup <= 2 ? v : hgroup == 3 ? q : p);
+  b = (hgroup <= 1 ? p : hgroup == 2 ? t : hgroup <= 4 ? v : q);
+  return PACK_COLOR(r, g, b);
+}
+
+/**
+ * Set the color of one LED in HSB (not sent to the strip in this function)
+ * \param strip The strip.
+ * \param led  The id of an LED (0〜)
+ * \param h    Hue        (0〜359)
+ * \param s    Saturation (0〜255)
+ * \param v    Brightness (  "   )
+ */
+void ledStripSetColorHSB(led_strip_t *strip, int led, int h, int s, int v)
+{
+  unsigned int c;
+
+  /* constrain the values within ranges */
+  h = CLAMP(h, 0, 359);
+  s = CLAMP(s, 0, RGB_MAX);
+  v = CLAMP(v, 0, RGB_MAX);
+
+  c = hsbToRgb(h, s, v);
+  ledStripSetColor(strip, led, c >> 16, (c >> 8) & 0xff, c & 0xff);
+}
+
+/**
+ * Set the colors of consecutive LEDs in HSB at once
+ * (not sent to the strip in this function).
+ * \param strip  The strip.
+ * \param start  The id of the first LED.
+ * \param count  The number of LEDs.
+ * \param h      count hues        (0〜359)
+ * \param s      count saturations (0〜255)
+ * \param v      count brightnesses (  "   )
+ * \return  The number of LEDs set (LEDs out of the strip are ignored).
+ */
+int ledStripSetColorsHSB(led_strip_t *strip, int start, int count,
+                         const int *h, const int *s, const int *v)
+{
+  unsigned int rgb[HSB_CHUNK];
+  int i, j, k, end;
+
+  if (strip == 0 || h == 0 || s == 0 || v == 0) { return 0; }
+  if (start < 0) {
+    h -= start;
+    s -= start;
+    v -= start;
+    count += start;
+    start = 0;
+  }
+  end = start + count;
+  if (end > strip->nLed) { end = strip->nLed; }
+
+  for (i = start; i < end; i += k) {
+    k = (end - i < HSB_CHUNK ? end - i : HSB_CHUNK);
+    for (j = 0; j < k; j++) {
+      rgb[j] = hsbToRgb(CLAMP(h[j], 0, 359), CLAMP(s[j], 0, RGB_MAX),
+                        CLAMP(v[j], 0, RGB_MAX));
+    }
+    for (j = 0; j < k; j++) {
+      int led = i + j;
+      unsigned int c = rgb[j];
+      if (strip->chOrder[led < strip->chLed[0] ? 0 : 1] == LED_ORDER_GRB) {
+        c = SWAP_RG(c);
+      }
+      storeColor(strip, led, c << (strip->bytesPerLed == 4 ? RGB_BITS : 0));
+    }
+    h += k;
+    s += k;
+    v += k;
+  }
+  return (end > start ? end - start : 0);
+}
+
+
+/*
+ * The functions for the default strip
+ * -----------------------------------
+ */
+
+/**
+ * Choose how the PWM generates the signal.
+ * Call this function before ledSetup().
+ * \param mode  LED_MODE_MS (one FIFO word per bit; default) or
+ *              LED_MODE_SERIAL (bits packed into words; less memory
+ *              and bus traffic, but the PWM clock is changed).
+ * \return  0 for success, -1 for failure.
+ */
+int ledSetMode(int mode)
+{
+  if (mode != LED_MODE_MS && mode != LED_MODE_SERIAL) { return -1; }
+  ledMode = mode;
+  return 0;
+}
+
+/**
+ * Choose the type of the LED chips (see ledStripCreateChip()).
+ * Call this function before ledSetup().
+ * \param chip  LED_CHIP_WS2812B (default), LED_CHIP_SK6812_RGBW,
+ *              LED_CHIP_WS2811, or LED_CHIP_APA106.
+ * \return  0 for success, -1 for failure.
+ */
+int ledSetChip(int chip)
+{
+  if (chip < 0 || chip >= N_CHIPS) { return -1; }
+  ledChip = chip;
+  return 0;
+}
+
+/**
+ * The type of the LED chips of a name (for command line options).
+ * \param name  "ws2812b", "sk6812" (RGBW), "ws2811", or "apa106".
+ * \return  LED_CHIP_*, or -1 for an unknown name.
+ */
+int ledChipByName(const char *name)
+{
+  int i;
+  for (i = 0; name != 0 && i < N_CHIPS; i++) {
+    if (strcmp(name, chips[i].name) == 0) { return i; }
+  }
+  return -1;
+}
+
+/**
+ * Setting up the hardware:
+ * call this function at the beginning.
+ * \param gpioPin  GPIO-number for the LED strip.
+ * \param n        The number of LEDs in the LED strip.
+ * \return  0 for success, -1 for failure.
+ */
+int ledSetup(int gpioPin, int n)
+{
+  if (n < 0) { return -1; }
+  if (defaultStrip != 0) { return -1; }
+  defaultStrip = ledStripCreateChip(gpioPin, n, ledMode, ledChip);
+  return (defaultStrip == 0 ? -1 : 0);
+}
+
+/**
+ * Setting up the hardware for two LED strips driven by the two PWM
+ * channels: call this function at the beginning instead of ledSetup().
+ * See ledStripCreateDual().
+ * \return  0 for success, -1 for failure.
+ */
+int ledSetupDual(int gpioPin1, int n1, int gpioPin2, int n2)
+{
+  if (n1 < 0 || n2 < 0) { return -1; }
+  if (defaultStrip != 0) { return -1; }
+  defaultStrip = ledStripCreateDualChip(gpioPin1, n1, gpioPin2, n2,
+                                        ledMode, ledChip);
+  return (defaultStrip == 0 ? -1 : 0);
+}
+
+/**
+ * Set the transmission order of R,G,B of a strip
+ * (see ledStripSetColorOrder()).
+ * \param strip  0, or 1 for the second strip of ledSetupDual().
+ * \param order  LED_ORDER_GRB or LED_ORDER_RGB
+ *               (the default depends on the chip; GRB for WS2812B).
+ * \return  0 for success, -1 for failure.
+ */
+int ledSetColorOrder(int strip, int order)
+{
+  return ledStripSetColorOrder(defaultStrip, strip, order);
+}
+
+/**
+ * The strip made by ledSetup() (0 before ledSetup()),
+ * to be passed to the functions taking a strip (e.g. ledfade.h).
+ */
+led_strip_t *ledGetStrip()
+{
+  return defaultStrip;
+}
+
+/**
+ * Cleaning up: call this function at the end.
+ */
+void ledCleanup()
+{
+  if (defaultStrip == 0) { return; }
+  if (defaultStrip->streaming) {
+    ledStripStreamStop(defaultStrip);
+  }
+  ledClearAll();  /* Turn off all lights! */
+  ledStripDestroy(defaultStrip);
+  defaultStrip = 0;
+}
+
+/**
+ * Set the color of one LED (not sent to the strip in this function)
+ * \param led  The id of an LED (0〜)
+ * \param r    The value of red   (0〜255)
+ * \param g    The value of green (  "   )
+ * \param b    The value of blue  (  "   )
+ */
+void ledSetColor(int led, int r, int g, int b)
+{
+  ledStripSetColor(defaultStrip, led, r, g, b);
+}
+
+/**
+ * Set the color of one LED with white (see ledStripSetColorRGBW()).
+ */
+void ledSetColorRGBW(int led, int r, int g, int b, int w)
+{
+  ledStripSetColorRGBW(defaultStrip, led, r, g, b, w);
+}
+
+/**
+ * Set the colors of consecutive LEDs at once
+ * (not sent to the strip in this function; see ledStripSetPixels()).
+ * \param start  The id of the first LED.
+ * \param count  The number of LEDs.
+ * \param pixels count * ledBytesPerLed() bytes of colors.
+ * \param order  The order of R,G,B in `pixels`
+ *               (LED_ORDER_RGB or LED_ORDER_GRB).
+ * \return  The number of LEDs set.
+ */
+int ledSetPixels(int start, int count, const unsigned char *pixels,
+                 int order)
+{
+  return ledStripSetPixels(defaultStrip, start, count, pixels, order);
+}
+
+/**
+ * The number of bytes of a pixel given to ledSetPixels():
+ * 3, or 4 for RGBW chips (known before ledSetup()).
+ */
+int ledBytesPerLed()
+{
+  return (defaultStrip != 0 ? defaultStrip->bytesPerLed
+                            : chips[ledChip].bytesPerLed);
+}
+
+/**
+ * Set the colors of all the LEDs and send them.
+ * \param pixels count * ledBytesPerLed() bytes of colors.
+ * \param count  The number of LEDs in `pixels`.
+ * \param order  The order of R,G,B in `pixels`.
+ */
+void ledSendFrame(const unsigned char *pixels, int count, int order)
+{
+  ledStripSendFrame(defaultStrip, pixels, count, order);
+}
+
+/**
+ * Send the color data to the LED strip!
+ * \return  0 for success, -1 for failure.
+ */
+int ledSend()
+{
+  return ledStripSend(defaultStrip);
+}
+
+/**
+ * Set how ledSend() handles a frame identical to the last one
+ * (see ledStripSetRefresh()).
+ * \param intervalMs  0: never send it (default); > 0: send it after
+ *                    this many milliseconds; -1: always send it.
+ * \return  0 for success, -1 for failure.
+ */
+int ledSetRefresh(int intervalMs)
+{
+  return ledStripSetRefresh(defaultStrip, intervalMs);
+}
+
+/**
+ * Set the number of threads encoding a frame in ledSend()
+ * (see ledStripSetThreads()).
+ * \param nThreads  1..8 including the caller; 0: the CPUs (default).
+ * \return  0 for success, -1 for failure.
+ */
+int ledSetThreads(int nThreads)
+{
+  return ledStripSetThreads(defaultStrip, nThreads);
+}
+
+/** Set the gamma of the color correction (see ledStripSetGamma()). */
+int ledSetGamma(int gamma100)
+{
+  return ledStripSetGamma(defaultStrip, gamma100);
+}
+
+/** Set the global brightness (see ledStripSetBrightness()). */
+int ledSetBrightness(int brightness)
+{
+  return ledStripSetBrightness(defaultStrip, brightness);
+}
+
+/** Turn on/off the temporal dithering (see ledStripSetDither()). */
+int ledSetDither(int on)
+{
+  return ledStripSetDither(defaultStrip, on);
+}
+
+/**
+ * Set the color of one LED in 16 bits per channel
+ * (not sent to the strip in this function; see ledStripSetColor16()).
+ * \param led  The id of an LED (0〜)
+ * \param r    The value of red   (0〜65535)
+ * \param g    The value of green (  "     )
+ * \param b    The value of blue  (  "     )
+ */
+void ledSetColor16(int led, int r, int g, int b)
+{
+  ledStripSetColor16(defaultStrip, led, r, g, b);
+}
+
+/**
+ * Limit the current drawn by the strip (see ledStripSetPowerLimit()).
+ * \param channelMa  The current of one channel at 255 (mA).
+ * \param idleMa     The current of one LED when it is black (mA).
+ * \param budgetMa   The maximum current of the strip (mA; 0: no limit).
+ * \return  0 for success, -1 for failure.
+ */
+int ledSetPowerLimit(int channelMa, int idleMa, int budgetMa)
+{
+  return ledStripSetPowerLimit(defaultStrip, channelMa, idleMa, budgetMa);
+}
+
+/** The estimated current in mA (see ledStripPowerMa()). */
+int ledPowerMa()
+{
+  return ledStripPowerMa(defaultStrip);
+}
+
+/**
+ * Start the streaming mode (see ledStripStreamStart()).
+ * \return  0 for success, -1 for failure.
+ */
+int ledStreamStart()
+{
+  return ledStripStreamStart(defaultStrip);
+}
+
+/**
+ * Stop the streaming mode (after the current frame is sent).
+ */
+void ledStreamStop()
+{
+  ledStripStreamStop(defaultStrip);
+}
+
+/**
+ * The number of frames sent by ledSend() in the streaming mode
+ * that the DMA has started to transmit.
+ */
+unsigned int ledStreamConsumed()
+{
+  return ledStripStreamConsumed(defaultStrip);
+}
+
+/**
+ * Wait until the frames sent by ledSend() have been transmitted.
+ * \param timeoutMs  Give up after this many milliseconds (-1: never).
+ * \return  0 for success, -1 for timeout or failure.
+ */
+int ledWaitSent(int timeoutMs)
+{
+  return ledStripWaitSent(defaultStrip, timeoutMs);
+}
+
+/**
+ * Turn off all lights.
+ */
+void ledClearAll()
+{
+  ledStripClearAll(defaultStrip);
+}
+
+/**
+ * Set the color of one LED in HSB (not sent to the strip in this function)
+ * \param led  The id of an LED (0〜)
+ * \param h    Hue        (0〜359)
+ * \param s    Saturation (0〜255)
+ * \param v    Brightness (  "   )
+ */
+void ledSetColorHSB(int led, int h, int s, int v)
+{
+  ledStripSetColorHSB(defaultStrip, led, h, s, v);
+}
+
+/**
+ * Set the colors of consecutive LEDs in HSB at once
+ * (not sent to the strip in this function; see ledStripSetColorsHSB()).
+ * \param start  The id of the first LED.
+ * \param count  The number of LEDs.
+ * \param h      count hues        (0〜359)
+ * \param s      count saturations (0〜255)
+ * \param v      count brightnesses (  "   )
+ * \return  The number of LEDs set.
+ */
+int ledSetColorsHSB(int start, int count,
+                    const int *h, const int *s, const int *v)
+{
+  return ledStripSetColorsHSB(defaultStrip, start, count, h, s, v);
 }
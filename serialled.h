@@ -1,20 +1,185 @@
-/* 最大LED数 */
-#define MAX_N_LED  100
+#ifndef SERIALLED_H
+#define SERIALLED_H
+
+/* 信号の生成方法 (ledSetMode()に指定) */
+#define LED_MODE_MS      0  /* 1ビットをPWMの1周期で表す (既定) */
+#define LED_MODE_SERIAL  1  /* 1ビットを3ビットに展開して詰めて送る */
+
+/* 信号の生成方法を選ぶ (ledSetup()より前に呼ぶ) */
+int ledSetMode(int mode);
+
+/* LEDのチップの種類 (ledSetChip()に指定) */
+#define LED_CHIP_WS2812B      0  /* 800kHz, GRB (既定) */
+#define LED_CHIP_SK6812_RGBW  1  /* 800kHz, GRBW (1素子32ビット) */
+#define LED_CHIP_WS2811       2  /* 400kHz, RGB */
+#define LED_CHIP_APA106       3  /* 約580kHz, RGB */
+
+/* チップの種類を選ぶ (ledSetup()より前に呼ぶ)
+ * タイミング, R,G,Bの送信順, 1素子のバイト数が決まる */
+int ledSetChip(int chip);
+
+/* 名前 ("ws2812b", "sk6812", "ws2811", "apa106") からチップの種類を得る */
+int ledChipByName(const char *name);
 
 /* セットアップするよ */
 int ledSetup(int gpioPin, int n);
 
+/* 2本のLEDテープをPWMの2チャネルで同時に光らせるためのセットアップ
+ * (LED番号は1本目が0〜n1-1, 2本目がn1〜n1+n2-1) */
+int ledSetupDual(int gpioPin1, int n1, int gpioPin2, int n2);
+
+/* R,G,Bの送信順 (ledSetColorOrder()に指定) */
+#define LED_ORDER_GRB  0  /* WS2812B (既定) */
+#define LED_ORDER_RGB  1
+
+/* テープごとのR,G,Bの送信順を設定 (strip: 0または1) */
+int ledSetColorOrder(int strip, int order);
+
 /* 後片付け */
 void ledCleanup(void);
 
 /* 1素子の色を設定 (まだ送信しない) */
 void ledSetColor(int led, int r, int g, int b);
 
+/* 1素子の色をR,G,B,W (白) で設定 (まだ送信しない; RGBWでないチップはWを無視) */
+void ledSetColorRGBW(int led, int r, int g, int b, int w);
+
 /* 1素子の色をHSBで設定 (まだ送信しない) */
 void ledSetColorHSB(int led, int h, int s, int v);
 
-/* 色情報を送信! */
-void ledSend(void);
+/* 連続する複数素子の色をHSBでまとめて設定 (まだ送信しない)
+ * h, s, v: それぞれcount個 (整数演算だけで変換するよ) */
+int ledSetColorsHSB(int start, int count,
+                    const int *h, const int *s, const int *v);
+
+/* 連続する複数素子の色をまとめて設定 (まだ送信しない)
+ * pixels: count*3バイト (RGBWのチップではcount*4バイトで, Wが最後),
+ * order: pixels中のR,G,Bの順 (LED_ORDER_RGBなど) */
+int ledSetPixels(int start, int count, const unsigned char *pixels,
+                 int order);
+
+/* 1素子のバイト数 (3, またはRGBWのチップなら4) */
+int ledBytesPerLed(void);
+
+/* 色情報を送信! (0: 成功, -1: DMAバッファに収まらないなど)
+ * 変化したLEDだけエンコードし直す. 前回と同じフレームは送らない */
+int ledSend(void);
+
+/* 前回と同じフレームの扱い (0: 送らない (既定),
+ * 正: 前回の送信からこのミリ秒たったら送る, -1: 毎回送る) */
+int ledSetRefresh(int intervalMs);
+
+/* 1フレームをエンコードするスレッド数 (呼び出し元を含めて1〜8;
+ * 0: CPUの数 (既定), 1: 呼び出し元だけ)
+ * 1024素子ごとに分けて並列にエンコードするので, 短いテープは1スレッドのまま */
+int ledSetThreads(int nThreads);
+
+/* 色補正: ガンマ値の100倍 (例: 220; 既定は100で補正なし) */
+int ledSetGamma(int gamma100);
+
+/* 色補正: 全体の明るさ (0〜255, 既定255) */
+int ledSetBrightness(int brightness);
+
+/* 色補正: 時間方向のディザリング (1: する, 0: しない (既定))
+ * 端数を次のフレームに持ち越すので, フレームを送り続けること */
+int ledSetDither(int on);
+
+/* 1素子の色を16ビット (0〜65535) で設定 (まだ送信しない) */
+void ledSetColor16(int led, int r, int g, int b);
+
+/* 電流の上限 (mA; 0なら制限しない) を超えないようにフレームを暗くする
+ * channelMa: R,G,Bそれぞれ255のときの電流, idleMa: 消灯時の1素子の電流 */
+int ledSetPowerLimit(int channelMa, int idleMa, int budgetMa);
+
+/* 今の色で推定した電流 (mA; 制限前. 上限未設定なら-1) */
+int ledPowerMa(void);
+
+/* 全素子の色をまとめて設定して送信 */
+void ledSendFrame(const unsigned char *pixels, int count, int order);
 
 /* 全部消しましょう */
 void ledClearAll(void);
+
+/* ストリーミング開始: DMAを止めずに最新のフレームを送り続ける */
+int ledStreamStart(void);
+
+/* ストリーミング終了 */
+void ledStreamStop(void);
+
+/* ストリーミング中, DMAが送信を始めたフレーム数 */
+unsigned int ledStreamConsumed(void);
+
+/* 送信が終わるまで待つ (timeoutMs: ミリ秒, -1なら無制限)
+ * 送信終了の予想時刻まで眠ってから確認する. 0: 完了, -1: タイムアウト */
+int ledWaitSent(int timeoutMs);
+
+/*
+ * LEDテープごとのハンドルを使う版
+ * (上の関数は ledSetup() が作るハンドルに対して働く)
+ */
+typedef struct led_strip led_strip_t;
+
+/* LEDテープを作る (mode: LED_MODE_MS または LED_MODE_SERIAL) */
+led_strip_t *ledStripCreate(int gpioPin, int n, int mode);
+
+/* PWMの2チャネルで2本のLEDテープを光らせるハンドルを作る */
+led_strip_t *ledStripCreateDual(int gpioPin1, int n1, int gpioPin2, int n2,
+                                int mode);
+
+/* チップの種類を指定してLEDテープを作る (chip: LED_CHIP_WS2812Bなど) */
+led_strip_t *ledStripCreateChip(int gpioPin, int n, int mode, int chip);
+led_strip_t *ledStripCreateDualChip(int gpioPin1, int n1,
+                                    int gpioPin2, int n2, int mode, int chip);
+
+/* 同時に出力できるLEDテープの本数 (ledStripCreateParallel()) */
+#define LED_PAR_MAX  16
+
+/* 複数本 (LED_PAR_MAX本まで) のLEDテープを任意のGPIO (0〜31) から
+ * 並列に出力するハンドルを作る (DMAがPWMの速さでGPSET0/GPCLR0に書く)
+ * pins: nPins本のGPIO番号, n: 1本あたりのLEDの個数
+ * (LED番号は1本目が0〜n-1, 2本目がn〜2n-1, ...; ストリーミングは不可) */
+led_strip_t *ledStripCreateParallel(const int *pins, int nPins, int n,
+                                    int chip);
+
+/* ハンドルを解放 (消灯はしない) */
+void ledStripDestroy(led_strip_t *strip);
+
+/* LEDの個数 */
+int ledStripLength(const led_strip_t *strip);
+
+/* 1フレームの送信時間 (マイクロ秒; 最大フレームレートの逆数) */
+int ledStripFrameUs(const led_strip_t *strip);
+
+/* ledSetup() が作ったハンドル (ledSetup()の前は0) */
+led_strip_t *ledGetStrip(void);
+
+/* 以下, 上の同名の関数 (ledStripを除いた名前) と同じ */
+int ledStripSetColorOrder(led_strip_t *strip, int ch, int order);
+void ledStripSetColor(led_strip_t *strip, int led, int r, int g, int b);
+void ledStripSetColorRGBW(led_strip_t *strip, int led,
+                          int r, int g, int b, int w);
+void ledStripSetColorHSB(led_strip_t *strip, int led, int h, int s, int v);
+int ledStripSetColorsHSB(led_strip_t *strip, int start, int count,
+                         const int *h, const int *s, const int *v);
+int ledStripSetPixels(led_strip_t *strip, int start, int count,
+                      const unsigned char *pixels, int order);
+int ledStripBytesPerLed(const led_strip_t *strip);
+void ledStripSendFrame(led_strip_t *strip, const unsigned char *pixels,
+                       int count, int order);
+int ledStripSend(led_strip_t *strip);
+int ledStripSetRefresh(led_strip_t *strip, int intervalMs);
+int ledStripSetThreads(led_strip_t *strip, int nThreads);
+int ledStripSetGamma(led_strip_t *strip, int gamma100);
+int ledStripSetBrightness(led_strip_t *strip, int brightness);
+int ledStripSetDither(led_strip_t *strip, int on);
+void ledStripSetColor16(led_strip_t *strip, int led, int r, int g, int b);
+int ledStripSetPowerLimit(led_strip_t *strip, int channelMa, int idleMa,
+                          int budgetMa);
+int ledStripPowerMa(const led_strip_t *strip);
+void ledStripClearAll(led_strip_t *strip);
+int ledStripStreamStart(led_strip_t *strip);
+void ledStripStreamStop(led_strip_t *strip);
+unsigned int ledStripStreamConsumed(led_strip_t *strip);
+int ledStripWaitSent(led_strip_t *strip, int timeoutMs);
+
+#endif /* SERIALLED_H */
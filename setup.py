@@ -0,0 +1,16 @@
+# A build setting of the CPython extension module (pyserialled.c).
+# $ make python    (or: python3 setup.py build_ext --inplace)
+
+from setuptools import setup, Extension
+
+setup(
+  name="pyserialled",
+  ext_modules=[
+    Extension("pyserialled",
+              sources=["pyserialled.c", "serialled.c", "pwmfifo.c",
+                       "pwmsim.c", "mailbox.c", "ledencode.c",
+                       "ledsched.c", "ledfade.c", "ledring.c",
+                       "ledpool.c"],
+              libraries=["m", "pthread", "rt"]),
+  ],
+)